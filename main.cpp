@@ -1,26 +1,341 @@
 #include <algorithm>
 #include <iostream>
+#include <fstream>
 #include <vector>
 #include <map>
 #include <set>
 #include <stack>
 #include <queue>
+#include <deque>
 #include <array>
 #include <utility>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <cctype>
+#include <iterator>
+#include <numeric>
+#include <functional>
+#include <stdexcept>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <type_traits>
+#include <bitset>
+#include "regex_expr.h"
 using namespace std;
 
-static const char EPS = '\0'; ///< 表示ε空转换的特殊字符
+static const int EPS = -1; ///< 表示ε空转换的特殊符号(不与任何字节等价类编号冲突)
+
+/**
+ * @brief 正则表达式不合法时抛出的异常
+ */
+struct RegexError : runtime_error {
+    size_t pos; ///< 出错位置(输入中的字符下标)
+
+    /**
+     * @brief 构造函数
+     * @param msg 错误描述
+     * @param p 出错位置
+     */
+    RegexError(const string &msg, size_t p)
+        :runtime_error(msg+" at position "+to_string(p)),pos(p){}
+
+    /**
+     * @brief 构造函数，用于构造自动机时才发现、与输入位置无关的错误
+     * @param msg 错误描述
+     */
+    explicit RegexError(const string &msg)
+        :runtime_error(msg),pos(string::npos){}
+};
+
+typedef chrono::steady_clock Clock;
+
+/**
+ * @brief 自since起经过的毫秒数
+ */
+static double elapsed_ms(Clock::time_point since) {
+    return chrono::duration<double,milli>(Clock::now()-since).count();
+}
+
+//-------------------- UTF-8 --------------------
+
+typedef pair<uint32_t,uint32_t> CodeRange; ///< 码点闭区间[first,second]
+
+static const uint32_t MAX_CODE_POINT = 0x10FFFF; ///< 最大的Unicode码点
+
+/**
+ * @brief 把码点编码为UTF-8
+ * @param cp 码点，不是代理项且不超过MAX_CODE_POINT
+ * @param out 输出缓冲区，至少4字节
+ * @return 编码的字节数
+ */
+static int utf8_encode(uint32_t cp, unsigned char out[4]) {
+    if (cp < 0x80) { out[0] = (unsigned char)cp; return 1; }
+    if (cp < 0x800) {
+        out[0] = (unsigned char)(0xC0|(cp>>6));
+        out[1] = (unsigned char)(0x80|(cp&0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (unsigned char)(0xE0|(cp>>12));
+        out[1] = (unsigned char)(0x80|((cp>>6)&0x3F));
+        out[2] = (unsigned char)(0x80|(cp&0x3F));
+        return 3;
+    }
+    out[0] = (unsigned char)(0xF0|(cp>>18));
+    out[1] = (unsigned char)(0x80|((cp>>12)&0x3F));
+    out[2] = (unsigned char)(0x80|((cp>>6)&0x3F));
+    out[3] = (unsigned char)(0x80|(cp&0x3F));
+    return 4;
+}
+
+/**
+ * @brief 把码点区间列表序列化为字节串，每个区间8字节，用于存放在语法树节点中
+ */
+static string encode_code_ranges(const vector<CodeRange> &ranges) {
+    string res(ranges.size()*8,'\0');
+    for (size_t i=0; i<ranges.size(); i++) {
+        memcpy(&res[i*8],&ranges[i].first,4);
+        memcpy(&res[i*8+4],&ranges[i].second,4);
+    }
+    return res;
+}
+
+/**
+ * @brief encode_code_ranges的逆过程
+ * @param text 序列化的区间列表
+ * @param len 字节数，为8的倍数
+ */
+static vector<CodeRange> decode_code_ranges(const char* text, int len) {
+    vector<CodeRange> res(len/8);
+    for (size_t i=0; i<res.size(); i++) {
+        memcpy(&res[i].first,text+i*8,4);
+        memcpy(&res[i].second,text+i*8+4,4);
+    }
+    return res;
+}
+
+/**
+ * @brief 码点区间对应的UTF-8字节层自动机(无环DFA，一个起始态，一个接受态)
+ *
+ * 先把每个区间在UTF-8编码长度和各续字节的边界处切开，使每一段恰好是
+ * 若干个字节区间的乘积，例如 U+0800..U+FFFF 中的 U+1000..U+CFFF 对应
+ * [E1-EC][80-BF][80-BF]；各段作为字节区间序列插入前缀树，共享公共前缀；
+ * 再自底向上把出边完全相同的状态合并，共享公共后缀，得到最小的无环自动机。
+ * 匹配时直接按字节转移，不需要解码。
+ */
+struct Utf8Automaton {
+    /**
+     * @brief 一条转移：from在字节区间[lo,hi]上转移到to
+     */
+    struct Edge {
+        int from;
+        unsigned char lo, hi;
+        int to;
+    };
+    int states = 0;     ///< 状态数，编号为[0,states)
+    int start = -1;     ///< 起始状态
+    int accept = -1;    ///< 接受状态
+    vector<Edge> edges; ///< 全部转移
+
+    /**
+     * @brief 编译码点区间列表
+     * @param ranges 码点区间，可以无序或重叠；代理项U+D800..U+DFFF被跳过
+     * @return 字节层自动机
+     */
+    static Utf8Automaton compile(const vector<CodeRange> &ranges) {
+        // 前缀树：每个节点的出边为(字节区间, 子节点)，子节点下标总大于父节点
+        struct TrieNode { vector<pair<pair<int,int>,int>> next; };
+        vector<TrieNode> trie(1);
+        for (auto &r: ranges) {
+            for (auto &seq: split(r.first,min(r.second,MAX_CODE_POINT))) {
+                int t = 0;
+                for (auto &br: seq) {
+                    int child = -1;
+                    for (auto &e: trie[t].next) {
+                        if (e.first == br) { child = e.second; break; }
+                    }
+                    if (child < 0) {
+                        child = (int)trie.size();
+                        trie[t].next.push_back({br,child});
+                        trie.emplace_back();
+                    }
+                    t = child;
+                }
+            }
+        }
+
+        // 自底向上合并出边相同的状态；UTF-8编码无前缀关系，所有叶子都是接受态
+        Utf8Automaton a;
+        a.accept = a.states++;
+        vector<int> canon(trie.size(),-1);
+        map<vector<int>,int> reg; // 出边(lo, hi, 目标)序列 -> 状态
+        for (int t=(int)trie.size()-1; t>=0; t--) {
+            auto &nx = trie[t].next;
+            if (nx.empty() && t != 0) { canon[t] = a.accept; continue; }
+            sort(nx.begin(),nx.end());
+            vector<int> key;
+            for (auto &e: nx) {
+                key.push_back(e.first.first);
+                key.push_back(e.first.second);
+                key.push_back(canon[e.second]);
+            }
+            auto it = reg.find(key);
+            if (it != reg.end() && t != 0) { canon[t] = it->second; continue; }
+            canon[t] = a.states++;
+            reg[key] = canon[t];
+            for (auto &e: nx) {
+                a.edges.push_back({canon[t],(unsigned char)e.first.first,
+                                   (unsigned char)e.first.second,canon[e.second]});
+            }
+        }
+        a.start = canon[0];
+        return a;
+    }
+
+private:
+    /**
+     * @brief 把码点区间切成若干段，每段的UTF-8编码恰好是各字节区间的乘积
+     * @return 按码点升序排列的字节区间序列
+     */
+    static vector<vector<pair<int,int>>> split(uint32_t lo, uint32_t hi) {
+        vector<vector<pair<int,int>>> res;
+        vector<CodeRange> st;
+        st.push_back({lo,hi});
+        while (!st.empty()) {
+            uint32_t s = st.back().first, e = st.back().second;
+            st.pop_back();
+            if (s > e) continue;
+            if (s <= 0xDFFF && e >= 0xD800) { // 去掉代理项
+                if (e > 0xDFFF) st.push_back({0xE000,e});
+                if (s < 0xD800) st.push_back({s,0xD7FF});
+                continue;
+            }
+            bool cut = false;
+            // 先按编码长度切开
+            for (uint32_t m: {0x7Fu,0x7FFu,0xFFFFu}) {
+                if (s <= m && m < e) {
+                    st.push_back({m+1,e});
+                    st.push_back({s,m});
+                    cut = true;
+                    break;
+                }
+            }
+            // 再使低6i位要么在两端都取遍、要么两端高位相同
+            unsigned char bs[4], be[4];
+            int n = utf8_encode(s,bs);
+            for (int i=1; i<n && !cut; i++) {
+                uint32_t m = (1u<<(6*i))-1;
+                if ((s&~m) == (e&~m)) continue;
+                if ((s&m) != 0) {
+                    st.push_back({(s|m)+1,e});
+                    st.push_back({s,s|m});
+                    cut = true;
+                } else if ((e&m) != m) {
+                    st.push_back({e&~m,e});
+                    st.push_back({s,(e&~m)-1});
+                    cut = true;
+                }
+            }
+            if (cut) continue;
+            utf8_encode(e,be);
+            vector<pair<int,int>> seq;
+            for (int i=0; i<n; i++) seq.push_back({bs[i],be[i]});
+            res.push_back(seq);
+        }
+        return res;
+    }
+};
 
 //-------------------- Regex Parser --------------------
 
+/**
+ * @brief 256位的字节集合，用于表示字符类
+ */
+struct ByteSet {
+    uint8_t bits[32]; ///< 第b位表示字节b是否在集合中
+
+    ByteSet() { fill(bits,bits+32,(uint8_t)0); }
+
+    /**
+     * @brief 从32字节的位图构造
+     */
+    static ByteSet from_bits(const char* p) {
+        ByteSet s;
+        copy(p,p+32,s.bits);
+        return s;
+    }
+
+    void add(unsigned char b) { bits[b>>3] |= (uint8_t)(1u<<(b&7)); } ///< 加入字节b
+    bool has(unsigned char b) const { return (bits[b>>3]>>(b&7))&1; } ///< 是否包含字节b
+
+    /**
+     * @brief 加入闭区间[lo,hi]内的所有字节
+     */
+    void add_range(unsigned char lo, unsigned char hi) {
+        for (int b=lo; b<=hi; b++) add((unsigned char)b);
+    }
+
+    /**
+     * @brief 取补集
+     */
+    void invert() {
+        for (auto &w: bits) w = (uint8_t)~w;
+    }
+
+    /**
+     * @brief 是否包含集合o中的全部字节
+     */
+    bool contains(const ByteSet &o) const {
+        for (int i=0; i<32; i++) {
+            if ((o.bits[i]&~bits[i]) != 0) return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief 并入集合o
+     */
+    void unite(const ByteSet &o) {
+        for (int i=0; i<32; i++) bits[i] |= o.bits[i];
+    }
+
+    /**
+     * @brief 集合中的字节数
+     */
+    int count() const {
+        int c = 0;
+        for (int b=0; b<256; b++) c += has((unsigned char)b);
+        return c;
+    }
+
+    const char* data() const { return reinterpret_cast<const char*>(bits); } ///< 位图
+};
+
 /**
  * @brief 表示正则表达式的语法树节点类型
  */
 struct RegexNode {
-    /// 节点类型枚举
-    enum Type { CHAR, CONCAT, UNION, STAR } type;
-    char ch;                 ///< 对于CHAR类型的节点，表示字符'0'或'1'
+    /// 节点类型枚举；EPSILON表示空串，只由化简等内部过程产生；STRING为连续字面量串；
+    /// CLASS为字节字符类；UCLASS为Unicode码点字符类，匹配码点的UTF-8编码；
+    /// REPEAT为有界重复r{m,n}，left为r；AND为交运算；NOT为补运算，left为被取补的子表达式
+    enum Type { CHAR, CONCAT, UNION, STAR, EPSILON, STRING, CLASS, UCLASS, REPEAT, AND, NOT } type;
+    static const int UNBOUNDED = -1; ///< REPEAT节点没有上界时的repeat_max()
+    char ch;                 ///< 对于CHAR类型的节点，表示该字节
     RegexNode *left, *right; ///< 左右子节点，适用于CONCAT、UNION等复合结构
+    const char *text;        ///< STRING节点的字面量串，CLASS节点的32字节位图，UCLASS节点
+                             ///< 序列化的码点区间，或REPEAT节点的上下界(存放于节点池)
+    int len;                 ///< text的长度
 
     /**
      * @brief 构造函数
@@ -30,428 +345,4166 @@ struct RegexNode {
      * @param r 右子节点
      */
     RegexNode(Type t, char c=0, RegexNode* l=nullptr, RegexNode* r=nullptr)
-        : type(t), ch(c), left(l), right(r){}
+        : type(t), ch(c), left(l), right(r), text(nullptr), len(0){}
+
+    /**
+     * @brief 是否为没有子节点的叶子
+     */
+    bool leaf() const { return type==CHAR || type==EPSILON || type==STRING || type==CLASS || type==UCLASS; }
+
+    /**
+     * @brief CLASS节点的字节集合
+     */
+    ByteSet bytes() const { return ByteSet::from_bits(text); }
+
+    /**
+     * @brief UCLASS节点的码点区间
+     */
+    vector<CodeRange> code_ranges() const { return decode_code_ranges(text,len); }
+
+    int repeat_min() const { return decode_bound(text); }   ///< REPEAT节点的重复下界
+    int repeat_max() const { return decode_bound(text+4); } ///< REPEAT节点的重复上界，或UNBOUNDED
+
+    /**
+     * @brief 把重复的上下界序列化为8字节，与节点的其他内容一样存放在text中
+     */
+    static string encode_bounds(int lo, int hi) {
+        string res(8,'\0');
+        memcpy(&res[0],&lo,4);
+        memcpy(&res[4],&hi,4);
+        return res;
+    }
+
+    /**
+     * @brief 读出序列化的一个界
+     */
+    static int decode_bound(const char* p) {
+        int v;
+        memcpy(&v,p,4);
+        return v;
+    }
 };
 
 /**
- * @brief 正则表达式解析器，将输入的正则表达式字符串解析为语法树
+ * @brief 语法树节点池，按块连续分配RegexNode，并随池一次性释放
+ *
+ * 每块容量固定且不会重新分配，因此已分配节点的地址在reset()之前保持有效；
+ * reset()清空所有块但保留其容量，便于在多个正则表达式之间复用。
+ *
+ * STRING节点的字面量串、CLASS节点的位图、UCLASS节点的码点区间、REPEAT节点的上下界
+ * 同样按块存放在池中。用borrow_text()登记的输入在reset()之前保持有效，
+ * 落在其中的字面量串直接指向输入，不复制。
+ *
+ * 开启内部化(interning)后，结构相同的节点(type, ch, left, right, 字面量串)
+ * 只创建一次，语法树因此成为共享子结构的DAG，指针相等即结构相等。
  */
-class RegexParser {
+class RegexNodePool {
 public:
+    typedef RegexNode* Node; ///< 节点句柄类型
+
+    /**
+     * @brief 空节点句柄
+     */
+    static Node none() { return nullptr; }
+
     /**
      * @brief 构造函数
-     * @param s 输入的正则表达式字符串
+     * @param block_size 每块可容纳的节点数
      */
-    explicit RegexParser(string s):str(std::move(s)),pos(0){}
+    explicit RegexNodePool(size_t block_size=4096)
+        :block_size(block_size),cur(0),text_cur(0),count(0),interning(false),
+         borrowed(nullptr),borrowed_len(0){}
 
     /**
-     * @brief 解析整个正则表达式
-     * @return 语法树的根节点
+     * @brief 开启或关闭节点内部化
+     * @param on 是否内部化
      */
-    RegexNode* parse() {
-        return parseUnion();
-    }
+    void set_interning(bool on) { interning = on; }
 
-private:
-    string str; ///< 正则表达式字符串
-    int pos;    ///< 当前解析位置
+    /**
+     * @brief 是否开启了节点内部化
+     */
+    bool is_interning() const { return interning; }
 
     /**
-     * @brief 解析包含'+'的联合(并)运算
-     * @return 对应的语法树节点
+     * @brief 登记在reset()之前保持有效的输入，其中的字面量串不再复制到池中
+     * @param data 输入起始地址(如映射的文件)
+     * @param n 输入长度
      */
-    RegexNode* parseUnion() {
-        RegexNode* node = parseConcat();
-        while (pos < static_cast<int>(str.size()) && str[pos] == '+') {
-            pos++;
-            RegexNode* right = parseConcat();
-            node = new RegexNode(RegexNode::UNION,0,node,right);
-        }
-        return node;
+    void borrow_text(const char* data, size_t n) {
+        borrowed = data;
+        borrowed_len = n;
     }
 
     /**
-     * @brief 解析连接运算
-     * @return 对应的语法树节点
+     * @brief 在池中创建一个节点；内部化模式下返回已有的相同节点
+     * @return 新节点(或共享节点)的指针
      */
-    RegexNode* parseConcat() {
-        RegexNode* node = parseStar();
-        while (pos < (int)str.size() && (str[pos] != ')' && str[pos] != '+')) {
-            RegexNode* right = parseStar();
-            node = new RegexNode(RegexNode::CONCAT,0,node,right);
-        }
+    RegexNode* make(RegexNode::Type t, char c=0, RegexNode* l=nullptr, RegexNode* r=nullptr) {
+        if (!interning) return allocate(t,c,l,r);
+        NodeKey key{t,c,l,r,nullptr,0};
+        auto it = table.find(key);
+        if (it!=table.end()) return it->second;
+        RegexNode* node = allocate(t,c,l,r);
+        table.emplace(key,node);
         return node;
     }
 
     /**
-     * @brief 解析Kleene闭包（*）
-     * @return 对应的语法树节点
+     * @brief 创建字面量串节点，长度为1时退化为CHAR节点
+     * @param s 字面量串(不在borrow_text()登记的输入中时复制到池中)
+     * @param n 串长度，至少为1
+     * @return 新节点(或共享节点)的指针
      */
-    RegexNode* parseStar() {
-        RegexNode* node = parseBase();
-        while (pos < (int)str.size() && str[pos] == '*') {
-            pos++;
-            node = new RegexNode(RegexNode::STAR,0,node,nullptr);
-        }
-        return node;
+    RegexNode* make_string(const char* s, int n) {
+        if (n == 1) return make(RegexNode::CHAR,s[0]);
+        return make_payload(RegexNode::STRING,s,n);
     }
 
     /**
-     * @brief 解析基本单元(字符或括号内的子表达式)
-     * @return 对应的语法树节点
+     * @brief 创建字符类节点，只含一个字节时退化为CHAR节点
+     * @param set 字节集合，非空
+     * @return 新节点(或共享节点)的指针
      */
-    RegexNode* parseBase() {
-        if (pos >= (int)str.size()) return nullptr;
-        if (str[pos] == '(') {
-            pos++;
-            RegexNode* node = parseUnion();
-            if (pos < (int)str.size() && str[pos] == ')') {
-                pos++;
+    RegexNode* make_class(const ByteSet &set) {
+        if (set.count() == 1) {
+            for (int b=0; b<256; b++) {
+                if (set.has((unsigned char)b)) return make(RegexNode::CHAR,(char)b);
             }
-            return node;
-        } else if (str[pos] == '0' || str[pos] == '1') {
-            RegexNode* node = new RegexNode(RegexNode::CHAR,str[pos]);
-            pos++;
-            return node;
         }
-        return nullptr;
+        return make_payload(RegexNode::CLASS,set.data(),32);
     }
-};
 
-//-------------------- NFA定义 --------------------
+    /**
+     * @brief 创建Unicode码点类节点
+     * @param ranges 升序且互不相交的码点区间
+     * @return 新节点(或共享节点)的指针
+     */
+    RegexNode* make_uclass(const vector<CodeRange> &ranges) {
+        string t = encode_code_ranges(ranges);
+        return make_payload(RegexNode::UCLASS,t.data(),(int)t.size());
+    }
 
-/**
- * @brief 非确定性有限自动机(NFA)的结构定义
- */
-struct NFA {
     /**
-     * @brief NFA状态结构
+     * @brief 创建有界重复节点child{lo,hi}
+     * @param child 被重复的子表达式
+     * @param lo 下界
+     * @param hi 上界，或RegexNode::UNBOUNDED
+     * @return 新节点(或共享节点)的指针
      */
-    struct State {
-        int id;                             ///< 状态编号
-        bool accept = false;                ///< 是否为接受状态
-        map<char,vector<int>> trans;        ///< 转移函数，char到状态集合的映射
+    RegexNode* make_repeat(RegexNode* child, int lo, int hi) {
+        string t = RegexNode::encode_bounds(lo,hi);
+        return make_payload(RegexNode::REPEAT,t.data(),(int)t.size(),child);
+    }
+
+    /**
+     * @brief 释放池中全部节点(保留已申请的内存块)
+     */
+    void reset() {
+        for (auto &b: blocks) b.clear();
+        for (auto &b: text_blocks) b.clear();
+        table.clear();
+        cur = 0;
+        text_cur = 0;
+        count = 0;
+        borrowed = nullptr;
+        borrowed_len = 0;
+    }
+
+    /**
+     * @brief 当前已分配的节点数
+     */
+    size_t size() const { return count; }
+
+    /**
+     * @brief 预先申请足以再容纳n个节点的块
+     * @param n 预计新增的节点数
+     */
+    void reserve(size_t n) {
+        size_t avail = blocks.empty()?0:blocks[cur].capacity()-blocks[cur].size();
+        for (size_t i=cur+1; i<blocks.size(); i++) avail += blocks[i].capacity();
+        while (avail < n) {
+            blocks.emplace_back();
+            blocks.back().reserve(block_size);
+            avail += block_size;
+        }
+    }
+
+private:
+    size_t block_size;                ///< 每块容量
+    size_t cur;                       ///< 当前正在使用的块
+    size_t text_cur;                  ///< 当前正在使用的字面量块
+    size_t count;                     ///< 已分配节点数
+    bool interning;                   ///< 是否内部化
+    vector<vector<RegexNode>> blocks; ///< 节点块，块内存连续且地址稳定
+    vector<vector<char>> text_blocks; ///< 字面量串块，同样不会重新分配
+    const char* borrowed;             ///< 直接引用的输入，为空表示没有
+    size_t borrowed_len;              ///< 直接引用的输入长度
+
+    /**
+     * @brief 内部化表的键：节点的全部结构字段
+     */
+    struct NodeKey {
+        RegexNode::Type type;
+        char ch;
+        RegexNode *left, *right;
+        const char *text;
+        int len;
+        bool operator==(const NodeKey &o) const {
+            return type==o.type && ch==o.ch && left==o.left && right==o.right
+                && len==o.len && equal(text,text+len,o.text);
+        }
     };
-    vector<State> states;  ///< 状态集合
-    int start;             ///< 起始状态ID
+    struct NodeKeyHash {
+        size_t operator()(const NodeKey &k) const {
+            size_t h = hash<int>()(k.type)*31 + hash<char>()(k.ch);
+            h = h*1000003 ^ hash<RegexNode*>()(k.left);
+            h = h*1000003 ^ hash<RegexNode*>()(k.right);
+            for (int i=0; i<k.len; i++) h = h*131 + (unsigned char)k.text[i];
+            return h;
+        }
+    };
+    unordered_map<NodeKey,RegexNode*,NodeKeyHash> table; ///< 内部化表
 
     /**
-     * @brief 创建新状态
-     * @param accept 是否为接受态
-     * @return 新状态的ID
+     * @brief 在当前块末尾放置一个新节点
      */
-    int new_state(bool accept=false) {
-        State s;
-        s.id = (int)states.size();
-        s.accept = accept;
-        states.push_back(s);
-        return s.id;
+    RegexNode* allocate(RegexNode::Type t, char c, RegexNode* l, RegexNode* r) {
+        if (blocks.empty() || blocks[cur].size()==blocks[cur].capacity()) next_block();
+        blocks[cur].emplace_back(t,c,l,r);
+        count++;
+        return &blocks[cur].back();
     }
-};
 
-/**
- * @brief NFA片段，用于Thompson构造法中间过程表示
- */
-struct NFAFragment {
-    int start;  ///< 片段的起始状态
-    int accept; ///< 片段的接受状态
+    /**
+     * @brief 创建带有text内容的节点(STRING、CLASS、UCLASS或带有子节点l的REPEAT)
+     */
+    RegexNode* make_payload(RegexNode::Type t, const char* s, int n, RegexNode* l=nullptr) {
+        NodeKey key{t,0,l,nullptr,s,n};
+        if (interning) {
+            auto it = table.find(key);
+            if (it!=table.end()) return it->second;
+        }
+        RegexNode* node = allocate(t,0,l,nullptr);
+        node->text = t==RegexNode::STRING && in_borrowed(s,n)?s:store_text(s,n);
+        node->len = n;
+        if (interning) {
+            key.text = node->text;
+            table.emplace(key,node);
+        }
+        return node;
+    }
+
+    /**
+     * @brief [s,s+n)是否位于borrow_text()登记的输入中
+     */
+    bool in_borrowed(const char* s, int n) const {
+        less_equal<const char*> le;
+        return borrowed && le(borrowed,s) && le(s+n,borrowed+borrowed_len);
+    }
+
+    /**
+     * @brief 把字面量串复制到字面量块中
+     * @return 池中副本的地址
+     */
+    const char* store_text(const char* s, int n) {
+        size_t need = (size_t)n;
+        if (text_blocks.empty() || text_blocks[text_cur].capacity()-text_blocks[text_cur].size()<need) {
+            while (text_cur+1<text_blocks.size()
+                   && text_blocks[text_cur+1].capacity()<need) text_cur++;
+            if (text_cur+1<text_blocks.size()) {
+                text_cur++;
+            } else {
+                text_blocks.emplace_back();
+                text_blocks.back().reserve(max(need,block_size*sizeof(RegexNode)));
+                text_cur = text_blocks.size()-1;
+            }
+        }
+        vector<char> &b = text_blocks[text_cur];
+        size_t at = b.size();
+        b.insert(b.end(),s,s+n);
+        return b.data()+at;
+    }
+
+    /**
+     * @brief 切换到下一块，必要时申请新块
+     */
+    void next_block() {
+        if (!blocks.empty() && cur+1<blocks.size()) {
+            cur++;
+            return;
+        }
+        blocks.emplace_back();
+        blocks.back().reserve(block_size);
+        cur = blocks.size()-1;
+    }
 };
 
 /**
- * @brief 使用Thompson构造法将正则表达式语法树转换为ε-NFA
+ * @brief 正则表达式解析器，将输入的正则表达式字符串解析为语法树
+ *
+ * 采用调度场(shunting-yard)算法，用显式的运算数栈和运算符栈代替递归下降，
+ * 因此解析所需的原生调用栈深度与输入长度及括号嵌套深度无关。
+ * 连接运算在相邻的两个运算单元之间隐式插入，优先级为 *、{m,n} > 连接 > ~(补) > &(交) > +，
+ * 连接、交与并运算均为左结合；前缀的~作用于其后直到'&'、'+'或')'为止的连接，
+ * 例如~01&1*即(~(01))&(1*)。极大的连续字面量(不含紧跟'*'或'{'的最后一个)
+ * 合成一个STRING节点。
+ *
+ * 重复次数写作r{m}、r{m,}或r{m,n}，生成REPEAT节点，不在语法树中展开。
+ *
+ * 除元字符 ( ) + * [ ] { } \ & ~ 外的任何可见字节都是字面量；"\c"表示字面量c，
+ * "\xHH"表示十六进制值为HH的字节，"\u{H...}"表示码点的UTF-8编码。
+ * 字符类写作[...]，支持区间a-f、取反[^...]及其中的转义，生成CLASS节点；
+ * 含有"\u{...}"或UTF-8编码的非ASCII字符时成为码点类，生成UCLASS节点。
+ *
+ * 节点通过Builder创建：RegexNodePool生成指针树，FlatRegex生成扁平的后序数组。
+ * Builder需提供节点句柄类型Node、空句柄none()以及make()/make_string()/
+ * make_class()/make_uclass()/make_repeat()。
+ *
+ * 输入以不拥有所有权的(指针, 长度)片段逐块送入feed()，解析器不复制输入；
+ * 一个片段处理完毕后即可释放，因此可以边读边解析。
+ * 输入不合法(非法字符、缺少运算对象、括号不匹配)时抛出RegexError。
  */
-class Thompson {
+template<class Builder>
+class BasicRegexParser {
 public:
+    typedef typename Builder::Node Node; ///< 节点句柄类型
+
     /**
      * @brief 构造函数
-     * @param root 正则表达式语法树的根节点
+     * @param p 创建语法树节点的Builder(节点池或扁平数组)
+     */
+    explicit BasicRegexParser(Builder &p):pos(0),pool(p),prev_operand(false),lex(NORMAL){}
+
+    /**
+     * @brief 解析一段完整的正则表达式
+     * @param data 正则表达式文本
+     * @param n 文本长度
+     * @return 语法树的根节点
+     */
+    Node parse(const char* data, size_t n) {
+        reset();
+        feed(data,n);
+        return finish();
+    }
+
+    /**
+     * @brief 清空解析状态，准备解析新的正则表达式
+     */
+    void reset() {
+        operands.clear();
+        ops.clear();
+        run.clear();
+        prev_operand = false;
+        lex = NORMAL;
+        pos = 0;
+    }
+
+    /**
+     * @brief 按预估的规模预留语法树和解析栈的空间
+     * @param nodes 预计的节点数
+     * @param depth 括号的最大嵌套深度
      */
-    Thompson(RegexNode* root):r(root){}
+    void reserve(size_t nodes, size_t depth) {
+        pool.reserve(nodes);
+        if (ops.capacity() < depth+2) ops.reserve(depth+2);
+        if (operands.capacity() < depth+2) operands.reserve(depth+2);
+    }
+
+    /**
+     * @brief 送入下一段输入
+     * @param data 片段起始地址，只在本次调用期间被访问
+     * @param n 片段长度
+     */
+    void feed(const char* data, size_t n) {
+        chunk = data;
+        run_begin = run_end = 0;
+        for (size_t i=0; i<n; i++, pos++) {
+            char c = data[i];
+            if (lex != NORMAL) {
+                lex_token_byte((unsigned char)c,i);
+                continue;
+            }
+            if (!is_meta(c)) {
+                if ((unsigned char)c < 0x20) throw RegexError("unexpected control character",pos);
+                // 片段内的连续字面量只记录区间，不复制
+                if (run_end != i) run_begin = run_end = i;
+                run_end = i+1;
+                continue;
+            }
+            if (c == '\\') { // 转义的字面量仍属于当前的连续字面量
+                lex = ESCAPE;
+                escape_in_class = false;
+                continue;
+            }
+            flush_run(c == '*' || c == '{');
+            if (c == '[') {
+                begin_class();
+            } else if (c == ']') {
+                throw RegexError("unmatched ']'",pos);
+            } else if (c == '{') {
+                if (!prev_operand) throw RegexError("'{' without operand",pos);
+                lex = REP_MIN;
+                rep_lo = 0;
+                rep_hi = 0;
+                rep_digits = 0;
+            } else if (c == '}') {
+                throw RegexError("unmatched '}'",pos);
+            } else if (c == '(') {
+                if (prev_operand) push_operator('.');
+                ops.push_back('(');
+                prev_operand = false;
+            } else if (c == ')') {
+                if (!prev_operand) throw RegexError("missing operand before ')'",pos);
+                reduce_while(0);
+                if (ops.empty()) throw RegexError("unmatched ')'",pos);
+                ops.pop_back(); // 弹出'('
+                prev_operand = true;
+            } else if (c == '+' || c == '&') {
+                if (!prev_operand) throw RegexError(string("missing operand before '")+c+"'",pos);
+                push_operator(c);
+                prev_operand = false;
+            } else if (c == '~') {
+                // 前缀运算符：不归约栈中的运算符，只在需要时补上隐式连接
+                if (prev_operand) push_operator('.');
+                ops.push_back('~');
+                prev_operand = false;
+            } else if (c == '*') {
+                if (!prev_operand) throw RegexError("'*' without operand",pos);
+                operands.back() = pool.make(RegexNode::STAR,0,operands.back(),Builder::none());
+                prev_operand = true;
+            } else {
+                throw RegexError(string("unexpected character '")+c+"'",pos);
+            }
+        }
+        // 跨越片段边界的字面量暂存起来，与下一片段的开头拼接
+        run.insert(run.end(),data+run_begin,data+run_end);
+        run_begin = run_end = 0;
+        chunk = nullptr;
+    }
+
+    /**
+     * @brief 输入结束，完成解析
+     * @return 语法树的根节点
+     */
+    Node finish() {
+        if (lex != NORMAL) {
+            bool in_escape = lex==ESCAPE || lex==HEX1 || lex==HEX2 || lex==UNI_OPEN || lex==UNI;
+            bool in_repeat = lex==REP_MIN || lex==REP_MAX;
+            throw RegexError(in_escape?"incomplete escape":in_repeat?"unterminated '{'":"unterminated '['",pos);
+        }
+        flush_run(false);
+        if (!prev_operand) throw RegexError("unexpected end of regex",pos);
+        reduce_while(0);
+        if (!ops.empty()) throw RegexError("unmatched '('",pos);
+        return operands.back();
+    }
+
+private:
+    size_t pos;                  ///< 已处理的输入字符数
+    Builder &pool;               ///< 节点池或扁平数组
+    vector<Node> operands;       ///< 运算数栈
+    vector<char> ops;            ///< 运算符栈：'('、'.'(连接)、'+'(并)、'&'(交)、'~'(补)
+    vector<char> run;            ///< 从前面片段延续下来、尚未压栈的连续字面量
+    const char* chunk = nullptr; ///< 当前片段
+    size_t run_begin = 0;        ///< 当前片段内尚未压栈的连续字面量区间起点
+    size_t run_end = 0;          ///< 当前片段内尚未压栈的连续字面量区间终点
+    bool prev_operand;           ///< 上一个记号是否结束了一个运算单元
+
+    /// 词法状态：普通、'\'之后、"\x"之后的两个十六进制位、"\u"之后的'{'与十六进制位、
+    /// 字符类内部(开头可以是'^')、字符类中多字节UTF-8字符的续字节、重复次数的下界与上界
+    enum LexState { NORMAL, ESCAPE, HEX1, HEX2, UNI_OPEN, UNI, CLASS_FIRST, CLASS, CLASS_UTF8,
+                    REP_MIN, REP_MAX };
+    static const int MAX_REPEAT = 100000; ///< 重复次数的上限
+    LexState lex;        ///< 当前词法状态，可跨越片段边界
+    bool escape_in_class = false; ///< 当前转义序列是否位于字符类之中
+    uint32_t hex = 0;    ///< "\xHH"或"\u{...}"中已读入的数值
+    int hex_digits = 0;  ///< "\u{...}"中已读入的十六进制位数
+    int utf8_left = 0;   ///< 字符类中当前UTF-8字符尚缺的续字节数
+    int utf8_len = 0;    ///< 字符类中当前UTF-8字符的总字节数
+    vector<CodeRange> class_items; ///< 正在读入的字符类的成员区间
+    long class_last = -1;      ///< 字符类中上一个单独的成员，可作为区间的起点
+    bool class_range = false;  ///< 是否刚读入区间的'-'
+    bool class_negate = false; ///< 是否为取反的字符类[^...]
+    bool class_unicode = false; ///< 字符类中是否出现了"\u{...}"或非ASCII的UTF-8字符
+    int rep_lo = 0;      ///< 正在读入的重复下界
+    int rep_hi = 0;      ///< 正在读入的重复上界，UNBOUNDED表示"{m,}"
+    int rep_digits = 0;  ///< 当前的界已读入的数字个数
+
+    /**
+     * @brief 是否为元字符(其余可见字节都是字面量)
+     */
+    static bool is_meta(char c) {
+        return c=='(' || c==')' || c=='+' || c=='*' || c=='[' || c==']' || c=='\\' || c=='{' || c=='}'
+            || c=='&' || c=='~';
+    }
+
+    /**
+     * @brief 十六进制数字的值，不是十六进制数字时为-1
+     */
+    static int hex_value(unsigned char c) {
+        if (c>='0' && c<='9') return c-'0';
+        if (c>='a' && c<='f') return c-'a'+10;
+        if (c>='A' && c<='F') return c-'A'+10;
+        return -1;
+    }
+
+    /**
+     * @brief 处理多字节记号(转义序列、字符类、重复次数)内部的一个字节
+     * @param c 当前字节
+     * @param i 当前字节在片段中的下标
+     */
+    void lex_token_byte(unsigned char c, size_t i) {
+        switch (lex) {
+            case ESCAPE:
+                if (c == 'x') {
+                    lex = HEX1;
+                } else if (c == 'u') {
+                    lex = UNI_OPEN;
+                } else {
+                    escaped(c,false,i);
+                }
+                return;
+            case HEX1:
+                if (hex_value(c) < 0) throw RegexError("invalid hex escape",pos);
+                hex = (uint32_t)hex_value(c);
+                lex = HEX2;
+                return;
+            case HEX2:
+                if (hex_value(c) < 0) throw RegexError("invalid hex escape",pos);
+                escaped(hex*16+(uint32_t)hex_value(c),false,i);
+                return;
+            case UNI_OPEN:
+                if (c != '{') throw RegexError("expected '{' after \\u",pos);
+                hex = 0;
+                hex_digits = 0;
+                lex = UNI;
+                return;
+            case UNI:
+                if (c == '}' && hex_digits > 0) {
+                    if (hex > MAX_CODE_POINT || (hex >= 0xD800 && hex <= 0xDFFF)) {
+                        throw RegexError("invalid code point",pos);
+                    }
+                    escaped(hex,true,i);
+                    return;
+                }
+                if (hex_value(c) < 0 || ++hex_digits > 6) throw RegexError("invalid \\u escape",pos);
+                hex = hex*16+(uint32_t)hex_value(c);
+                return;
+            case CLASS_UTF8:
+                if ((c&0xC0) != 0x80) throw RegexError("invalid UTF-8 in character class",pos);
+                hex = (hex<<6)|(c&0x3F);
+                if (--utf8_left > 0) return;
+                // 拒绝超长编码、代理项和超出范围的码点
+                if ((utf8_len==2 && hex<0x80) || (utf8_len==3 && hex<0x800) || (utf8_len==4 && hex<0x10000)
+                    || hex > MAX_CODE_POINT || (hex >= 0xD800 && hex <= 0xDFFF)) {
+                    throw RegexError("invalid UTF-8 in character class",pos);
+                }
+                lex = CLASS;
+                class_unicode = true;
+                class_item(hex);
+                return;
+            case CLASS_FIRST:
+                lex = CLASS;
+                if (c == '^' && !class_negate) {
+                    class_negate = true;
+                    lex = CLASS_FIRST;
+                    return;
+                }
+                // fallthrough
+            case CLASS:
+                if (c < 0x20) throw RegexError("unexpected control character",pos);
+                if (c >= 0x80) {
+                    // 字符类中的非ASCII字节按UTF-8解码为码点
+                    if (c >= 0xC2 && c <= 0xDF) { utf8_len = 2; hex = c&0x1F; }
+                    else if (c >= 0xE0 && c <= 0xEF) { utf8_len = 3; hex = c&0x0F; }
+                    else if (c >= 0xF0 && c <= 0xF4) { utf8_len = 4; hex = c&0x07; }
+                    else throw RegexError("invalid UTF-8 in character class",pos);
+                    utf8_left = utf8_len-1;
+                    lex = CLASS_UTF8;
+                } else if (c == '\\') {
+                    lex = ESCAPE;
+                    escape_in_class = true;
+                } else if (c == ']') {
+                    if (class_range) class_item('-');
+                    if (class_items.empty()) throw RegexError("empty character class",pos);
+                    lex = NORMAL;
+                    if (prev_operand) push_operator('.');
+                    operands.push_back(make_class_node());
+                    prev_operand = true;
+                } else if (c == '-' && class_last >= 0 && !class_range) {
+                    class_range = true;
+                } else {
+                    class_item(c);
+                }
+                return;
+            case REP_MIN:
+            case REP_MAX:
+                if (c >= '0' && c <= '9') {
+                    int &v = lex==REP_MIN?rep_lo:rep_hi;
+                    if (lex == REP_MAX && v == RegexNode::UNBOUNDED) v = 0;
+                    v = v*10+(c-'0');
+                    rep_digits++;
+                    if (v > MAX_REPEAT) throw RegexError("repetition count too large",pos);
+                } else if (c == ',' && lex == REP_MIN && rep_digits > 0) {
+                    lex = REP_MAX;
+                    rep_hi = RegexNode::UNBOUNDED;
+                    rep_digits = 0;
+                } else if (c == '}' && (rep_digits > 0 || lex == REP_MAX)) {
+                    if (lex == REP_MIN) rep_hi = rep_lo;
+                    if (rep_hi != RegexNode::UNBOUNDED && rep_hi < rep_lo) {
+                        throw RegexError("invalid repetition bounds",pos);
+                    }
+                    lex = NORMAL;
+                    operands.back() = pool.make_repeat(operands.back(),rep_lo,rep_hi);
+                    prev_operand = true;
+                } else {
+                    throw RegexError("invalid repetition",pos);
+                }
+                return;
+            case NORMAL:
+                return;
+        }
+    }
+
+    /**
+     * @brief 转义序列结束
+     * @param v 转义得到的字节("\c"、"\xHH")或码点("\u{...}")
+     * @param code_point v是否为码点
+     * @param i 转义序列最后一个字节在片段中的下标
+     */
+    void escaped(uint32_t v, bool code_point, size_t i) {
+        if (escape_in_class) {
+            escape_in_class = false;
+            lex = CLASS;
+            if (code_point) class_unicode = true;
+            class_item(v);
+            return;
+        }
+        lex = NORMAL;
+        if (!code_point) {
+            literal_byte((unsigned char)v,i);
+            return;
+        }
+        // 字符类之外的码点是一个运算单元：多字节的UTF-8编码单独成为STRING节点，
+        // 其后的'*'与重复次数作用于整个字符，而不是最后一个字节
+        unsigned char buf[4];
+        int n = utf8_encode(v,buf);
+        if (n == 1) {
+            literal_byte(buf[0],i);
+            return;
+        }
+        flush_run(false);
+        if (prev_operand) push_operator('.');
+        operands.push_back(pool.make_string((const char*)buf,n));
+        prev_operand = true;
+        run_begin = run_end = i+1;
+    }
+
+    /**
+     * @brief 开始读入一个字符类
+     */
+    void begin_class() {
+        lex = CLASS_FIRST;
+        class_items.clear();
+        class_last = -1;
+        class_range = false;
+        class_negate = false;
+        class_unicode = false;
+    }
+
+    /**
+     * @brief 字符类中读入一个成员，必要时与前面的'-'组成区间
+     */
+    void class_item(uint32_t v) {
+        if (class_range) {
+            if (v < (uint32_t)class_last) throw RegexError("invalid range in character class",pos);
+            class_items.back().second = v;
+            class_range = false;
+            class_last = -1;
+        } else {
+            class_items.push_back({v,v});
+            class_last = (long)v;
+        }
+    }
+
+    /**
+     * @brief 由读入的成员生成字符类节点
+     *
+     * 不含码点成员时，各成员按字节解释，生成CLASS节点；否则按码点解释，
+     * 合并区间(取反时相对全体码点取补)，仍只含ASCII时同样生成CLASS节点，
+     * 否则生成UCLASS节点，由Thompson构造编译为UTF-8字节层自动机。
+     */
+    Node make_class_node() {
+        if (!class_unicode) {
+            ByteSet set;
+            for (auto &r: class_items) set.add_range((unsigned char)r.first,(unsigned char)r.second);
+            if (class_negate) set.invert();
+            return pool.make_class(set);
+        }
+        sort(class_items.begin(),class_items.end());
+        vector<CodeRange> merged;
+        for (auto &r: class_items) {
+            if (!merged.empty() && r.first <= merged.back().second+1) {
+                merged.back().second = max(merged.back().second,r.second);
+            } else {
+                merged.push_back(r);
+            }
+        }
+        if (class_negate) {
+            vector<CodeRange> inv;
+            uint32_t next = 0;
+            for (auto &r: merged) {
+                if (r.first > next) inv.push_back({next,r.first-1});
+                next = r.second+1;
+            }
+            if (next <= MAX_CODE_POINT) inv.push_back({next,MAX_CODE_POINT});
+            merged.swap(inv);
+        }
+        if (merged.empty() || merged.back().second < 0x80) {
+            ByteSet set;
+            for (auto &r: merged) set.add_range((unsigned char)r.first,(unsigned char)r.second);
+            return pool.make_class(set);
+        }
+        return pool.make_uclass(merged);
+    }
+
+    /**
+     * @brief 把一个转义得到的字面量接到当前连续字面量之后
+     * @param c 字面量字节
+     * @param i 转义序列最后一个字节在片段中的下标
+     */
+    void literal_byte(unsigned char c, size_t i) {
+        if (chunk) run.insert(run.end(),chunk+run_begin,chunk+run_end);
+        run.push_back((char)c);
+        run_begin = run_end = i+1;
+    }
+
+    /**
+     * @brief 把连续字面量作为一个STRING运算单元压栈
+     * @param split_last 最后一个字面量是否单独成为运算单元(其后紧跟'*'或'{'时)
+     */
+    void flush_run(bool split_last) {
+        const char* text;
+        int n;
+        if (run.empty()) {
+            text = chunk?chunk+run_begin:nullptr;
+            n = (int)(run_end-run_begin);
+        } else {
+            if (chunk) run.insert(run.end(),chunk+run_begin,chunk+run_end);
+            text = run.data();
+            n = (int)run.size();
+        }
+        run_begin = run_end = 0;
+        if (n == 0) return;
+        int head = split_last?n-1:n;
+        if (head > 0) {
+            if (prev_operand) push_operator('.');
+            operands.push_back(pool.make_string(text,head));
+            prev_operand = true;
+        }
+        if (split_last) {
+            if (prev_operand) push_operator('.');
+            operands.push_back(pool.make(RegexNode::CHAR,text[n-1]));
+            prev_operand = true;
+        }
+        run.clear();
+    }
+
+    /**
+     * @brief 运算符优先级
+     * @param op 运算符
+     * @return 优先级，'('最低
+     */
+    static int precedence(char op) {
+        switch (op) {
+            case '.': return 4;
+            case '~': return 3;
+            case '&': return 2;
+            case '+': return 1;
+            default: return 0;
+        }
+    }
+
+    /**
+     * @brief 归约栈顶所有优先级不低于prec的运算符('~'为一元，其余为二元)
+     * @param prec 优先级下限
+     */
+    void reduce_while(int prec) {
+        while (!ops.empty() && ops.back()!='(' && precedence(ops.back())>=prec) {
+            char op = ops.back(); ops.pop_back();
+            Node right = operands.back(); operands.pop_back();
+            if (op == '~') {
+                operands.push_back(pool.make(RegexNode::NOT,0,right,Builder::none()));
+                continue;
+            }
+            Node left = operands.back(); operands.pop_back();
+            RegexNode::Type t = op=='.'?RegexNode::CONCAT:(op=='&'?RegexNode::AND:RegexNode::UNION);
+            operands.push_back(pool.make(t,0,left,right));
+        }
+    }
+
+    /**
+     * @brief 压入二元运算符，先归约栈中优先级不低于它的运算符(左结合)
+     * @param op 运算符
+     */
+    void push_operator(char op) {
+        reduce_while(precedence(op));
+        ops.push_back(op);
+    }
+};
+
+/**
+ * @brief 扁平的正则语法树：节点以32位下标引用，按后序(子节点先于父节点)存放
+ *
+ * 各字段分别存放在独立数组中(SoA)，Thompson构造只需按下标顺序扫描一遍。
+ * STRING节点的left/right分别为字面量在text中的起始位置和长度；
+ * CLASS、UCLASS节点同样把32字节位图、序列化的码点区间存放在text中；
+ * REPEAT节点的left为子节点，right为上下界在text中的起始位置。
+ */
+struct FlatRegex {
+    typedef uint32_t Node;                  ///< 节点句柄类型(下标)
+    static const uint32_t NONE = 0xffffffffu; ///< 空节点
+
+    vector<uint8_t> type;   ///< 节点类型(RegexNode::Type)
+    vector<char> ch;        ///< CHAR节点的字符
+    vector<uint32_t> left;  ///< 左子节点下标
+    vector<uint32_t> right; ///< 右子节点下标
+    vector<char> text;      ///< 所有STRING节点的字面量、CLASS/UCLASS节点的内容
+
+    /**
+     * @brief 空节点句柄
+     */
+    static Node none() { return NONE; }
+
+    /**
+     * @brief 追加一个节点
+     * @return 新节点的下标
+     */
+    Node make(RegexNode::Type t, char c=0, Node l=NONE, Node r=NONE) {
+        type.push_back((uint8_t)t);
+        ch.push_back(c);
+        left.push_back(l);
+        right.push_back(r);
+        return (Node)(type.size()-1);
+    }
+
+    /**
+     * @brief 追加一个字面量串节点，长度为1时退化为CHAR节点
+     */
+    Node make_string(const char* s, int n) {
+        if (n == 1) return make(RegexNode::CHAR,s[0]);
+        Node id = make(RegexNode::STRING,0,(Node)text.size(),(Node)n);
+        text.insert(text.end(),s,s+n);
+        return id;
+    }
+
+    /**
+     * @brief 追加一个字符类节点，只含一个字节时退化为CHAR节点
+     */
+    Node make_class(const ByteSet &set) {
+        if (set.count() == 1) {
+            for (int b=0; b<256; b++) {
+                if (set.has((unsigned char)b)) return make(RegexNode::CHAR,(char)b);
+            }
+        }
+        Node id = make(RegexNode::CLASS,0,(Node)text.size(),32);
+        text.insert(text.end(),set.data(),set.data()+32);
+        return id;
+    }
+
+    /**
+     * @brief 追加一个Unicode码点类节点
+     */
+    Node make_uclass(const vector<CodeRange> &ranges) {
+        string t = encode_code_ranges(ranges);
+        Node id = make(RegexNode::UCLASS,0,(Node)text.size(),(Node)t.size());
+        text.insert(text.end(),t.begin(),t.end());
+        return id;
+    }
+
+    /**
+     * @brief 追加一个有界重复节点，right为上下界在text中的位置
+     */
+    Node make_repeat(Node child, int lo, int hi) {
+        string t = RegexNode::encode_bounds(lo,hi);
+        Node id = make(RegexNode::REPEAT,0,child,(Node)text.size());
+        text.insert(text.end(),t.begin(),t.end());
+        return id;
+    }
+
+    /**
+     * @brief 节点数
+     */
+    size_t size() const { return type.size(); }
+
+    /**
+     * @brief 预留再容纳n个节点的空间，按倍增方式扩容以免反复重新分配
+     * @param n 预计新增的节点数
+     */
+    void reserve(size_t n) {
+        size_t need = type.size()+n;
+        if (need <= type.capacity()) return;
+        need = max(need,2*type.capacity());
+        type.reserve(need); ch.reserve(need); left.reserve(need); right.reserve(need);
+    }
+
+    /**
+     * @brief 清空全部节点(保留容量)
+     */
+    void clear() {
+        type.clear(); ch.clear(); left.clear(); right.clear(); text.clear();
+    }
+};
+
+typedef BasicRegexParser<RegexNodePool> RegexParser; ///< 生成指针树的解析器
+typedef BasicRegexParser<FlatRegex> FlatRegexParser; ///< 生成扁平数组的解析器
+
+//-------------------- 表达式构造器 --------------------
+
+/**
+ * @brief 把regex_expr.h中组合的表达式生成为语法树，Builder为RegexNodePool或FlatRegex
+ *
+ * 表达式按后序调用这里的函数，生成与解析相同文本得到的语法树。
+ */
+template<class Builder>
+struct ExprBuilder {
+    typedef typename Builder::Node Node; ///< 节点句柄类型
+    Builder &b;
+
+    explicit ExprBuilder(Builder &b):b(b){}
+
+    Node epsilon() { return b.make(RegexNode::EPSILON); }
+    Node byte(char c) { return b.make(RegexNode::CHAR,c); }
+    Node string(const char* s, int n) { return b.make_string(s,n); }
+    Node code_class(const vector<CodeRange> &ranges) { return b.make_uclass(ranges); }
+
+    Node byte_class(const bitset<256> &bytes) {
+        ByteSet set;
+        for (int c=0; c<256; c++) {
+            if (bytes[c]) set.add((unsigned char)c);
+        }
+        return b.make_class(set);
+    }
+
+    Node binary(regex_expr::Op op, Node l, Node r) {
+        RegexNode::Type t = op==regex_expr::CONCAT?RegexNode::CONCAT:op==regex_expr::UNION?RegexNode::UNION:RegexNode::AND;
+        return b.make(t,0,l,r);
+    }
+
+    Node unary(regex_expr::Op op, Node a) {
+        return b.make(op==regex_expr::STAR?RegexNode::STAR:RegexNode::NOT,0,a,Builder::none());
+    }
+
+    Node repeat(Node a, int lo, int hi) {
+        return b.make_repeat(a,lo,hi==regex_expr::UNBOUNDED?(int)RegexNode::UNBOUNDED:hi);
+    }
+};
+
+//-------------------- 语法树化简 --------------------
+
+/**
+ * @brief 展开同类型运算(并或连接)的嵌套链，按从左到右的顺序返回各运算对象
+ * @param node 语法树节点
+ * @param t 要展开的运算类型(UNION或CONCAT)
+ * @return 运算对象列表；node不是t类型时只含node本身
+ */
+static vector<RegexNode*> flatten_chain(RegexNode* node, RegexNode::Type t) {
+    vector<RegexNode*> res;
+    vector<RegexNode*> st;
+    st.push_back(node);
+    while (!st.empty()) {
+        RegexNode* n = st.back(); st.pop_back();
+        if (n->type == t) {
+            st.push_back(n->right);
+            st.push_back(n->left);
+        } else {
+            res.push_back(n);
+        }
+    }
+    return res;
+}
+
+/**
+ * @brief 判断两棵语法树结构是否相同(内部化的节点直接比较指针)
+ */
+static bool same_structure(RegexNode* a, RegexNode* b) {
+    vector<pair<RegexNode*,RegexNode*>> st;
+    st.push_back({a,b});
+    while (!st.empty()) {
+        RegexNode* x = st.back().first;
+        RegexNode* y = st.back().second;
+        st.pop_back();
+        if (x == y) continue;
+        if (!x || !y || x->type != y->type || x->ch != y->ch) return false;
+        if (x->len != y->len || !equal(x->text,x->text+x->len,y->text)) return false;
+        st.push_back({x->left,y->left});
+        st.push_back({x->right,y->right});
+    }
+    return true;
+}
+
+/**
+ * @brief 语法树中是否有满足pred的节点类型
+ * @param root 指针语法树的根(共享节点只检查一次)
+ * @param pred 节点类型谓词
+ */
+static bool tree_has(RegexNode* root, bool (*pred)(RegexNode::Type)) {
+    vector<RegexNode*> work{root};
+    unordered_set<RegexNode*> seen;
+    while (!work.empty()) {
+        RegexNode* node = work.back();
+        work.pop_back();
+        if (!node || !seen.insert(node).second) continue;
+        if (pred(node->type)) return true;
+        if (node->leaf()) continue;
+        work.push_back(node->left);
+        work.push_back(node->right);
+    }
+    return false;
+}
+
+/**
+ * @brief 扁平语法树中是否有满足pred的节点类型
+ */
+static bool tree_has(const FlatRegex &f, bool (*pred)(RegexNode::Type)) {
+    for (uint8_t t: f.type) {
+        if (pred((RegexNode::Type)t)) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief 在Thompson构造之前，用Kleene代数恒等式化简正则语法树
+ *
+ * 应用的恒等式均保持语言不变：
+ * - (r*)* = r*，r*r* = r*，(x*+y)* = (x+y)*
+ * - 并运算去重：r+r = r
+ * - 并运算吸收：若 s ⊆ r 则 r+s = r，其中 s ⊆ r* 按结构保守判定
+ *   (例如 (0+1)*+(0+1)*0 = (0+1)*)
+ * 化简结果中的新节点由节点池分配，未变化的子树原样复用。
+ */
+class RegexSimplifier {
+public:
+    /**
+     * @brief 构造函数
+     * @param p 新节点所在的节点池
+     */
+    explicit RegexSimplifier(RegexNodePool &p):pool(p),applied(0){}
+
+    /**
+     * @brief 化简语法树
+     * @param root 语法树根节点
+     * @return 化简后的根节点
+     */
+    RegexNode* simplify(RegexNode* root) {
+        if (!root) return root;
+        done.clear();
+        vector<pair<RegexNode*,bool>> work; // (节点, 子节点是否已化简)
+        work.push_back({root,false});
+        while (!work.empty()) {
+            RegexNode* node = work.back().first;
+            bool expanded = work.back().second;
+            work.pop_back();
+            if (done.count(node)) continue;
+            if (!expanded && !node->leaf()) {
+                work.push_back({node,true});
+                if (node->right) work.push_back({node->right,false});
+                work.push_back({node->left,false});
+                continue;
+            }
+            done[node] = rewrite(node);
+        }
+        return done[root];
+    }
+
+    /**
+     * @brief 已应用的化简规则次数
+     */
+    long long rewrites() const { return applied; }
+
+private:
+    RegexNodePool &pool;                          ///< 节点池
+    long long applied;                            ///< 已应用的规则次数
+    unordered_map<RegexNode*,RegexNode*> done;    ///< 原节点 -> 化简结果
+
+    /**
+     * @brief 在子节点均已化简的前提下化简单个节点
+     * @param node 原节点
+     * @return 化简结果
+     */
+    RegexNode* rewrite(RegexNode* node) {
+        if (node->leaf()) return node;
+        RegexNode* l = done[node->left];
+        RegexNode* r = node->right?done[node->right]:nullptr;
+        switch(node->type) {
+            case RegexNode::STAR: {
+                if (l->type == RegexNode::STAR) { // (r*)* = r*
+                    applied++;
+                    return l;
+                }
+                if (l->type == RegexNode::UNION) { // (x*+y)* = (x+y)*
+                    vector<RegexNode*> alts = alternatives(l);
+                    bool changed = false;
+                    for (auto &a: alts) {
+                        if (a->type == RegexNode::STAR) { a = a->left; changed = true; }
+                    }
+                    if (changed) {
+                        applied++;
+                        return pool.make(RegexNode::STAR,0,make_union(dedupe(alts)),nullptr);
+                    }
+                }
+                break;
+            }
+            case RegexNode::CONCAT: {
+                if (r->type == RegexNode::STAR) {
+                    // r*r* = r*，连接链左结合，因此也检查左子树的最右项
+                    RegexNode* last = l->type==RegexNode::CONCAT?l->right:l;
+                    if (same_structure(last,r)) {
+                        applied++;
+                        return l;
+                    }
+                }
+                break;
+            }
+            case RegexNode::UNION: {
+                vector<RegexNode*> alts = alternatives(l);
+                vector<RegexNode*> ralts = alternatives(r);
+                alts.insert(alts.end(),ralts.begin(),ralts.end());
+                size_t n = alts.size();
+                alts = dedupe(alts);
+                if (alts.size() != n) {
+                    applied += (long long)(n-alts.size());
+                    return make_union(alts);
+                }
+                break;
+            }
+            default:
+                break;
+        }
+        if (l == node->left && r == node->right) return node;
+        if (node->type == RegexNode::REPEAT) return pool.make_repeat(l,node->repeat_min(),node->repeat_max());
+        return pool.make(node->type,node->ch,l,r);
+    }
+
+    /**
+     * @brief 展开嵌套的并运算，按从左到右的顺序返回各分支
+     */
+    static vector<RegexNode*> alternatives(RegexNode* node) {
+        return flatten_chain(node,RegexNode::UNION);
+    }
+
+    /**
+     * @brief 去掉重复的分支以及被其他分支包含的分支，保持原有顺序
+     * @param alts 分支列表
+     * @return 保留的分支
+     */
+    static vector<RegexNode*> dedupe(const vector<RegexNode*> &alts) {
+        vector<RegexNode*> kept;
+        for (RegexNode* a: alts) {
+            bool absorbed = false;
+            for (RegexNode* k: kept) {
+                if (subsumed(a,k)) { absorbed = true; break; }
+            }
+            if (absorbed) continue;
+            vector<RegexNode*> rest;
+            for (RegexNode* k: kept) {
+                if (!subsumed(k,a)) rest.push_back(k);
+            }
+            rest.push_back(a);
+            kept.swap(rest);
+        }
+        return kept;
+    }
+
+    /**
+     * @brief 将分支列表重新组合为左结合的并运算
+     * @param alts 非空分支列表
+     * @return 并运算节点(只有一个分支时即该分支)
+     */
+    RegexNode* make_union(const vector<RegexNode*> &alts) {
+        RegexNode* node = alts[0];
+        for (size_t i=1; i<alts.size(); i++) {
+            node = pool.make(RegexNode::UNION,0,node,alts[i]);
+        }
+        return node;
+    }
+
+    /**
+     * @brief 保守判定 L(b) ⊆ L(a)
+     */
+    static bool subsumed(RegexNode* b, RegexNode* a) {
+        if (same_structure(b,a)) return true;
+        return a->type == RegexNode::STAR && in_star(b,a->left);
+    }
+
+    /**
+     * @brief 叶子节点(CHAR、STRING、CLASS)中出现的字节
+     */
+    static ByteSet leaf_bytes(RegexNode* x) {
+        if (x->type == RegexNode::CLASS) return x->bytes();
+        ByteSet set;
+        if (x->type == RegexNode::CHAR) set.add((unsigned char)x->ch);
+        for (int i=0; x->type==RegexNode::STRING && i<x->len; i++) set.add((unsigned char)x->text[i]);
+        return set;
+    }
+
+    /**
+     * @brief 保守判定 L(b) ⊆ L(s*)：b的每个叶子部分都是s、s*或s的某个分支
+     */
+    static bool in_star(RegexNode* b, RegexNode* s) {
+        vector<RegexNode*> salts = alternatives(s);
+        ByteSet atoms; // s中单字节分支(字面量与字符类)的并集
+        for (RegexNode* a: salts) {
+            if (a->type == RegexNode::CHAR || a->type == RegexNode::CLASS) atoms.unite(leaf_bytes(a));
+        }
+        vector<RegexNode*> st;
+        st.push_back(b);
+        while (!st.empty()) {
+            RegexNode* x = st.back(); st.pop_back();
+            if (x->type == RegexNode::EPSILON) continue;
+            if (same_structure(x,s)) continue;
+            if (x->type == RegexNode::STAR && same_structure(x->left,s)) continue;
+            bool is_alt = false;
+            for (RegexNode* a: salts) {
+                if (same_structure(x,a)) { is_alt = true; break; }
+            }
+            if (is_alt) continue;
+            if (x->type == RegexNode::CHAR || x->type == RegexNode::STRING || x->type == RegexNode::CLASS) {
+                // 字面量(串)的每个字节、字符类的每个成员都属于s的单字节分支时包含于s*
+                if (!atoms.contains(leaf_bytes(x))) return false;
+                continue;
+            }
+            if (x->type == RegexNode::CONCAT || x->type == RegexNode::UNION) {
+                st.push_back(x->left);
+                st.push_back(x->right);
+            } else if (x->type == RegexNode::STAR || x->type == RegexNode::REPEAT) {
+                st.push_back(x->left);
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+/**
+ * @brief 并运算的公共前缀/后缀提取(左因子分解)
+ *
+ * 把一条极大的并运算链的各分支视为连接因子序列插入前缀树，再由前缀树重建
+ * 表达式，例如 0110+0111+0101 变为 01(1(0+1)+01)；某一层所有分支以同一
+ * 因子结尾时，该因子也被提到并运算之后。分支恰好在前缀树内部结束时用
+ * EPSILON表示。这样Thompson构造的状态数随不同前缀的数量增长，
+ * 而不是随所有分支的总长度增长。
+ */
+class UnionFactorer {
+public:
+    /**
+     * @brief 构造函数
+     * @param p 新节点所在的节点池
+     */
+    explicit UnionFactorer(RegexNodePool &p):pool(p),factored(0){}
+
+    /**
+     * @brief 对语法树中所有极大并运算链做因子分解
+     * @param root 语法树根节点
+     * @return 分解后的根节点
+     */
+    RegexNode* factor(RegexNode* root) {
+        if (!root) return root;
+        done.clear();
+        vector<pair<RegexNode*,bool>> work; // (节点, 子节点是否已处理)
+        work.push_back({root,false});
+        while (!work.empty()) {
+            RegexNode* node = work.back().first;
+            bool expanded = work.back().second;
+            work.pop_back();
+            if (done.count(node)) continue;
+            if (!expanded && !node->leaf()) {
+                work.push_back({node,true});
+                if (node->type == RegexNode::UNION) {
+                    // 链内部的并节点不单独处理，直接展开到各分支
+                    vector<RegexNode*> alts = flatten_chain(node,RegexNode::UNION);
+                    for (auto it=alts.rbegin(); it!=alts.rend(); ++it) work.push_back({*it,false});
+                    continue;
+                }
+                if (node->right) work.push_back({node->right,false});
+                work.push_back({node->left,false});
+                continue;
+            }
+            done[node] = rebuild(node);
+        }
+        return done[root];
+    }
+
+    /**
+     * @brief 被分解的并运算链数量
+     */
+    long long chains() const { return factored; }
+
+private:
+    /**
+     * @brief 前缀树节点
+     */
+    /**
+     * @brief 连接因子：单个字面量(node为空)或其他子表达式
+     */
+    struct Factor {
+        RegexNode* node; ///< 非字面量因子
+        char ch;         ///< 字面量因子的字符
+        bool operator==(const Factor &o) const {
+            if (!node || !o.node) return !node && !o.node && ch==o.ch;
+            return same_structure(node,o.node);
+        }
+    };
+
+    /**
+     * @brief 前缀树节点
+     */
+    struct TrieNode {
+        vector<pair<Factor,int>> next; ///< (因子, 子节点下标)
+        bool terminal = false;         ///< 是否有分支在此结束
+    };
+
+    RegexNodePool &pool;                       ///< 节点池
+    long long factored;                        ///< 被分解的并运算链数量
+    unordered_map<RegexNode*,RegexNode*> done; ///< 原节点 -> 处理结果
+
+    /**
+     * @brief 在子节点均已处理的前提下重建单个节点
+     * @param node 原节点
+     * @return 重建结果
+     */
+    RegexNode* rebuild(RegexNode* node) {
+        if (node->leaf()) return node;
+        if (node->type == RegexNode::UNION) {
+            vector<RegexNode*> alts = flatten_chain(node,RegexNode::UNION);
+            for (auto &a: alts) a = done[a];
+            return factor_union(alts);
+        }
+        RegexNode* l = done[node->left];
+        RegexNode* r = node->right?done[node->right]:nullptr;
+        if (l == node->left && r == node->right) return node;
+        if (node->type == RegexNode::REPEAT) return pool.make_repeat(l,node->repeat_min(),node->repeat_max());
+        return pool.make(node->type,node->ch,l,r);
+    }
+
+    /**
+     * @brief 对一组分支做前缀树分解
+     * @param alts 分支列表
+     * @return 分解后的表达式
+     */
+    RegexNode* factor_union(const vector<RegexNode*> &alts) {
+        vector<TrieNode> trie(1);
+        for (RegexNode* a: alts) {
+            int t = 0;
+            auto insert = [&](const Factor &f) {
+                int child = -1;
+                for (auto &e: trie[t].next) {
+                    if (e.first == f) { child = e.second; break; }
+                }
+                if (child < 0) {
+                    child = (int)trie.size();
+                    trie[t].next.push_back({f,child});
+                    trie.emplace_back();
+                }
+                t = child;
+            };
+            // 字面量串拆成单个字面量，使不同分支可以共享串的前缀
+            for (RegexNode* f: flatten_chain(a,RegexNode::CONCAT)) {
+                if (f->type == RegexNode::CHAR) {
+                    insert({nullptr,f->ch});
+                } else if (f->type == RegexNode::STRING) {
+                    for (int i=0; i<f->len; i++) insert({nullptr,f->text[i]});
+                } else {
+                    insert({f,0});
+                }
+            }
+            trie[t].terminal = true;
+        }
+        factored++;
+
+        // 子节点下标总大于父节点，按下标倒序即可自底向上重建
+        vector<deque<Factor>> seq(trie.size()); // 每个前缀树节点对应的因子序列
+        for (int t=(int)trie.size()-1; t>=0; t--) {
+            auto &node = trie[t];
+            if (node.next.empty()) continue; // 叶子：空序列
+            vector<deque<Factor>> parts;
+            for (auto &e: node.next) {
+                deque<Factor> p = std::move(seq[e.second]);
+                p.push_front(e.first);
+                parts.push_back(std::move(p));
+            }
+            if (parts.size()==1 && !node.terminal) {
+                seq[t] = std::move(parts[0]);
+                continue;
+            }
+            // 所有分支以同一因子结尾时提取公共后缀
+            deque<Factor> suffix;
+            while (!node.terminal) {
+                bool common = true;
+                for (auto &p: parts) {
+                    if (p.empty() || !(p.back() == parts[0].back())) { common = false; break; }
+                }
+                if (!common) break;
+                suffix.push_front(parts[0].back());
+                for (auto &p: parts) p.pop_back();
+            }
+            vector<RegexNode*> branches;
+            for (auto &p: parts) branches.push_back(make_seq(p));
+            if (node.terminal) branches.push_back(pool.make(RegexNode::EPSILON));
+            RegexNode* u = branches[0];
+            for (size_t i=1; i<branches.size(); i++) {
+                u = pool.make(RegexNode::UNION,0,u,branches[i]);
+            }
+            seq[t] = std::move(suffix);
+            seq[t].push_front({u,0});
+        }
+        return make_seq(seq[0]);
+    }
+
+    /**
+     * @brief 将因子序列组合为左结合的连接运算，相邻字面量重新合成STRING节点，
+     *        空序列对应EPSILON
+     */
+    RegexNode* make_seq(const deque<Factor> &factors) {
+        if (factors.empty()) return pool.make(RegexNode::EPSILON);
+        RegexNode* node = nullptr;
+        vector<char> run;
+        size_t i = 0;
+        while (i < factors.size()) {
+            RegexNode* f = factors[i].node;
+            if (!f) {
+                run.clear();
+                while (i < factors.size() && !factors[i].node) run.push_back(factors[i++].ch);
+                f = pool.make_string(run.data(),(int)run.size());
+            } else {
+                i++;
+            }
+            node = node?pool.make(RegexNode::CONCAT,0,node,f):f;
+        }
+        return node;
+    }
+};
+
+//-------------------- 字母表 --------------------
+
+/**
+ * @brief 字节等价类：把正则表达式中无法区分的字节合并为同一个输入符号
+ *
+ * 两个字节属于同一类，当且仅当每个字面量、字符类以及码点类的UTF-8自动机中
+ * 的每个字节区间要么同时包含它们、要么同时不包含它们。自动机按类编号转移，DFA转移表每类一列，而不是每字节一列，
+ * 子集构造的代价也只与类的数目成正比。
+ *
+ * 字母表由表达式中出现的字节组成(含补运算时为全部字节)，'0'和'1'始终各自成为一类，
+ * 因此二进制正则表达式的输出与只支持0/1时完全一致。
+ * 字母表之外的字节没有类编号，在任何状态下都不被接受。
+ */
+class ByteClasses {
+public:
+    ByteClasses() { clear(); }
+
+    /**
+     * @brief 清空，只保留'0'和'1'两个类
+     */
+    void clear() {
+        sets.clear();
+        ByteSet b;
+        b.add('0');
+        sets.insert(string(b.data(),32));
+        b = ByteSet();
+        b.add('1');
+        sets.insert(string(b.data(),32));
+        build();
+    }
+
+    /**
+     * @brief 收集语法树中出现的所有字面量和字符类，并重新划分等价类
+     * @param root 语法树根节点
+     */
+    void collect(RegexNode* root) {
+        vector<RegexNode*> st;
+        unordered_map<RegexNode*,bool> seen; // 内部化的DAG中共享节点只访问一次
+        if (root) st.push_back(root);
+        while (!st.empty()) {
+            RegexNode* n = st.back(); st.pop_back();
+            if (seen.count(n)) continue;
+            seen[n] = true;
+            if (n->type == RegexNode::CHAR) add_byte((unsigned char)n->ch);
+            if (n->type == RegexNode::STRING) {
+                for (int i=0; i<n->len; i++) add_byte((unsigned char)n->text[i]);
+            }
+            if (n->type == RegexNode::CLASS) sets.insert(string(n->text,32));
+            if (n->type == RegexNode::UCLASS) add_code_ranges(n->code_ranges());
+            if (n->type == RegexNode::NOT) add_all_bytes();
+            if (n->left) st.push_back(n->left);
+            if (n->right) st.push_back(n->right);
+        }
+        build();
+    }
+
+    /**
+     * @brief 收集扁平语法树中出现的所有字面量和字符类，并重新划分等价类
+     * @param f 扁平语法树
+     */
+    void collect(const FlatRegex &f) {
+        for (size_t i=0; i<f.size(); i++) {
+            RegexNode::Type t = (RegexNode::Type)f.type[i];
+            if (t == RegexNode::CHAR) add_byte((unsigned char)f.ch[i]);
+            if (t == RegexNode::STRING) {
+                for (uint32_t k=0; k<f.right[i]; k++) add_byte((unsigned char)f.text[f.left[i]+k]);
+            }
+            if (t == RegexNode::CLASS) sets.insert(string(&f.text[f.left[i]],32));
+            if (t == RegexNode::UCLASS) add_code_ranges(decode_code_ranges(&f.text[f.left[i]],(int)f.right[i]));
+            if (t == RegexNode::NOT) add_all_bytes();
+        }
+        build();
+    }
+
+    /**
+     * @brief 等价类的数目
+     */
+    int size() const { return (int)labels.size(); }
+
+    /**
+     * @brief 字节b所属的类编号，不在字母表中时为-1
+     */
+    int of(unsigned char b) const { return cls[b]; }
+
+    /**
+     * @brief 类c中最小的字节，可代表整个类
+     */
+    unsigned char representative(int c) const { return first[c]; }
+
+    /**
+     * @brief 类c的输出名称：单个字节输出其本身(不可见字节为\xHH)，多个字节输出为[...]
+     */
+    const string& label(int c) const { return labels[c]; }
+
+private:
+    set<string> sets;      ///< 去重后的字节集合(32字节位图)
+    int cls[256];          ///< 字节 -> 类编号
+    vector<unsigned char> first; ///< 类编号 -> 最小字节
+    vector<string> labels; ///< 类编号 -> 输出名称
+
+    /**
+     * @brief 加入单个字节构成的集合
+     */
+    void add_byte(unsigned char b) {
+        ByteSet s;
+        s.add(b);
+        sets.insert(string(s.data(),32));
+    }
+
+    /**
+     * @brief 把全部256个字节加入字母表；补运算相对于全体字节串取补，
+     *        表达式中未出现的字节因此合成一类
+     */
+    void add_all_bytes() {
+        ByteSet s;
+        s.invert();
+        sets.insert(string(s.data(),32));
+    }
+
+    /**
+     * @brief 加入码点类编译出的UTF-8自动机中出现的每个字节区间
+     */
+    void add_code_ranges(const vector<CodeRange> &ranges) {
+        for (auto &e: Utf8Automaton::compile(ranges).edges) {
+            ByteSet s;
+            s.add_range(e.lo,e.hi);
+            sets.insert(string(s.data(),32));
+        }
+    }
+
+    /**
+     * @brief 用每个集合依次细分字母表，再按最小字节重新编号
+     */
+    void build() {
+        fill(cls,cls+256,-1);
+        vector<ByteSet> all;
+        for (auto &k: sets) all.push_back(ByteSet::from_bits(k.data()));
+        for (auto &a: all) {
+            for (int b=0; b<256; b++) {
+                if (a.has((unsigned char)b)) cls[b] = 0;
+            }
+        }
+        int n = 1;
+        for (auto &a: all) {
+            // 每个旧类按是否属于a一分为二
+            vector<int> split(2*n,-1);
+            int m = 0;
+            for (int b=0; b<256; b++) {
+                if (cls[b] < 0) continue;
+                int k = 2*cls[b]+a.has((unsigned char)b);
+                if (split[k] < 0) split[k] = m++;
+                cls[b] = split[k];
+            }
+            n = m;
+        }
+        // 按最小字节重新编号，使输出顺序稳定
+        vector<int> order(n,-1);
+        first.clear();
+        for (int b=0; b<256; b++) {
+            if (cls[b] < 0) continue;
+            if (order[cls[b]] < 0) {
+                order[cls[b]] = (int)first.size();
+                first.push_back((unsigned char)b);
+            }
+            cls[b] = order[cls[b]];
+        }
+        labels.assign(first.size(),string());
+        vector<vector<unsigned char>> members(first.size());
+        for (int b=0; b<256; b++) {
+            if (cls[b] >= 0) members[cls[b]].push_back((unsigned char)b);
+        }
+        for (size_t c=0; c<members.size(); c++) labels[c] = make_label(members[c]);
+    }
+
+    /**
+     * @brief 单个字节的输出形式
+     * @param b 字节
+     * @param in_class 是否位于[...]之中(此时'-'、'^'、']'也需转义)
+     */
+    static string byte_label(unsigned char b, bool in_class) {
+        bool special = b=='\\' || (in_class && (b=='-' || b=='^' || b==']'));
+        if (b > 0x20 && b < 0x7f && !special) return string(1,(char)b);
+        if (special) return string("\\")+(char)b;
+        static const char hex[] = "0123456789abcdef";
+        return string("\\x")+hex[b>>4]+hex[b&15];
+    }
+
+    /**
+     * @brief 由类的成员生成输出名称，连续三个以上的字节写作区间
+     * @param m 升序排列的成员
+     */
+    static string make_label(const vector<unsigned char> &m) {
+        if (m.size() == 1) return byte_label(m[0],false);
+        string res = "[";
+        for (size_t i=0; i<m.size(); ) {
+            size_t j = i;
+            while (j+1 < m.size() && m[j+1] == m[j]+1) j++;
+            res += byte_label(m[i],true);
+            if (j >= i+2) {
+                res += "-";
+                res += byte_label(m[j],true);
+            } else if (j == i+1) {
+                res += byte_label(m[j],true);
+            }
+            i = j+1;
+        }
+        return res+"]";
+    }
+};
+
+//-------------------- NFA定义 --------------------
+
+/**
+ * @brief 非确定性有限自动机(NFA)的结构定义
+ */
+struct NFA {
+    /**
+     * @brief NFA状态结构
+     */
+    struct State {
+        int id;                             ///< 状态编号
+        bool accept = false;                ///< 是否为接受状态
+        map<int,vector<int>> trans;         ///< 转移函数，字节等价类编号(或EPS)到状态集合的映射
+    };
+    vector<State> states;  ///< 状态集合
+    int start;             ///< 起始状态ID
+    ByteClasses alphabet;  ///< 输入字母表
+
+    /**
+     * @brief 创建新状态
+     * @param accept 是否为接受态
+     * @return 新状态的ID
+     */
+    int new_state(bool accept=false) {
+        State s;
+        s.id = (int)states.size();
+        s.accept = accept;
+        states.push_back(s);
+        return s.id;
+    }
+
+    /**
+     * @brief 转移(边)的总数，ε转移也计在内
+     */
+    size_t edges() const {
+        size_t n = 0;
+        for (auto &st: states) {
+            for (auto &kv: st.trans) n += kv.second.size();
+        }
+        return n;
+    }
+};
+
+/**
+ * @brief 只读的NFA，转移按符号分块以CSR(压缩稀疏行)形式连续存放
+ *
+ * 每个字节等价类一块，ε转移是最后一块。块内状态s的目标依次存放在
+ * target[offset[b+s] .. offset[b+s+1])，b为该块偏移数组的起点；
+ * 没有任何转移的符号不分配偏移数组。构造之后的各阶段都只读这种形式。
+ */
+struct FrozenNFA {
+    /**
+     * @brief 一条转移
+     */
+    struct Edge {
+        int from;   ///< 起点
+        int symbol; ///< 字节等价类编号或EPS
+        int to;     ///< 终点
+    };
+
+    /**
+     * @brief 连续存放的一段目标状态
+     */
+    struct Targets {
+        const int *first, *last;
+        const int *begin() const { return first; }
+        const int *end() const { return last; }
+        bool empty() const { return first==last; }
+    };
+
+    int start;            ///< 起始状态ID
+    vector<char> accept;  ///< accept[s]为状态s是否接受
+    ByteClasses alphabet; ///< 输入字母表
+
+    /**
+     * @brief 冻结NFA，每个状态、每个符号的目标保持原来的顺序
+     * @param a 输入的NFA(可以含ε转移)
+     */
+    explicit FrozenNFA(const NFA &a):start(a.start),alphabet(a.alphabet) {
+        vector<Edge> es;
+        es.reserve(a.edges());
+        accept.resize(a.states.size());
+        for (int s=0; s<(int)a.states.size(); s++) {
+            accept[s] = a.states[s].accept;
+            for (auto &kv: a.states[s].trans) {
+                for (int t: kv.second) es.push_back({s,kv.first,t});
+            }
+        }
+        build(es);
+    }
+
+    /**
+     * @brief 由转移列表构造，同一状态、同一符号的目标保持列表中的顺序
+     * @param alphabet 输入字母表
+     * @param start 起始状态ID
+     * @param accept 每个状态是否接受，其长度即状态数
+     * @param edges 全部转移
+     */
+    FrozenNFA(const ByteClasses &alphabet, int start, vector<char> accept, const vector<Edge> &edges)
+        :start(start),accept(move(accept)),alphabet(alphabet) {
+        build(edges);
+    }
+
+    int size() const { return (int)accept.size(); }   ///< 状态数
+    size_t edges() const { return target.size(); }    ///< 转移(边)的总数，ε转移也计在内
+    bool has_epsilon() const { return block.back()>=0; } ///< 是否含ε转移
+
+    /**
+     * @brief 状态s读入符号c(字节等价类编号或EPS)后的目标状态
+     */
+    Targets next(int s, int c) const {
+        int b = block[c==EPS?(int)block.size()-1:c];
+        if (b<0) return {nullptr,nullptr};
+        const int *t = target.data();
+        return {t+offset[b+s],t+offset[b+s+1]};
+    }
+
+    /**
+     * @brief 全部转移，按起点、符号(ε在最前)排列
+     */
+    vector<Edge> edge_list() const {
+        vector<Edge> es;
+        es.reserve(edges());
+        for (int s=0; s<size(); s++) {
+            for (int c=EPS; c<alphabet.size(); c++) {
+                for (int t: next(s,c)) es.push_back({s,c,t});
+            }
+        }
+        return es;
+    }
+
+    /**
+     * @brief 转移表占用的字节数
+     */
+    size_t bytes() const {
+        return (block.size()+offset.size()+target.size())*sizeof(int)+accept.size();
+    }
+
+private:
+    vector<int> block;  ///< block[c]为符号c的偏移数组在offset中的起点，-1表示该符号没有转移
+    vector<int> offset; ///< 各块的偏移数组依次相接，每块状态数+1项
+    vector<int> target; ///< 全部目标状态，按符号、起点排列
+
+    /**
+     * @brief 按(符号,起点)计数排序转移
+     */
+    void build(const vector<Edge> &edges) {
+        int n = size(), k = alphabet.size();
+        vector<int> count(k+1,0);
+        for (auto &e: edges) count[e.symbol==EPS?k:e.symbol]++;
+        block.assign(k+1,-1);
+        int blocks = 0;
+        for (int c=0; c<=k; c++) {
+            if (count[c]>0) block[c] = (blocks++)*(n+1);
+        }
+        // 先在offset[b+s+1]处计数，前缀和之后offset[b+s]即状态s的第一个目标的位置
+        offset.assign((size_t)blocks*(n+1),0);
+        for (auto &e: edges) offset[block[e.symbol==EPS?k:e.symbol]+e.from+1]++;
+        int sum = 0;
+        for (int c=0; c<=k; c++) {
+            if (block[c]<0) continue;
+            int *o = offset.data()+block[c];
+            o[0] = sum;
+            for (int s=1; s<=n; s++) o[s] = sum += o[s];
+        }
+        target.resize(edges.size());
+        vector<int> fill(offset);
+        for (auto &e: edges) target[fill[block[e.symbol==EPS?k:e.symbol]+e.from]++] = e.to;
+    }
+};
+
+/**
+ * @brief NFA片段，用于Thompson构造法中间过程表示
+ */
+struct NFAFragment {
+    int start;  ///< 片段的起始状态
+    int accept; ///< 片段的接受状态
+};
+
+/**
+ * @brief 使用Thompson构造法将正则表达式语法树转换为ε-NFA
+ *
+ * 语法树按后序遍历，遍历与片段拼接都使用显式栈，不随树深度递归。
+ *
+ * 交(AND)与补(NOT)没有对应的Thompson片段：先照常构建子表达式的片段，
+ * 再把它们取出为独立的ε-NFA，由ProductConstruction构造乘积或补自动机，
+ * 结果替换子片段原来占用的状态区间。
+ *
+ * 有界重复按副本展开，嵌套的上界相乘(0{100000}{100000}有10^10个副本)；
+ * 展开复制出的状态总数超过REPEAT_LIMIT时抛出RegexError，而不是耗尽内存。
+ */
+class Thompson {
+public:
+    enum { REPEAT_LIMIT = 1<<22 }; ///< 重复展开时复制出的状态总数上限
+
+    /**
+     * @brief 构造函数
+     * @param root 正则表达式语法树的根节点
+     * @param a 输入字母表，须已收集该语法树中的所有字节
+     * @param reuse 是否复用共享节点(内部化DAG)已构建的片段
+     */
+    Thompson(RegexNode* root, const ByteClasses &a, bool reuse=false)
+        :r(root),reuse(reuse),flat(nullptr),flat_root(FlatRegex::NONE),alphabet(a),hint(0){}
+
+    /**
+     * @brief 构造函数
+     * @param f 扁平语法树
+     * @param root 根节点下标
+     * @param a 输入字母表，须已收集该语法树中的所有字节
+     */
+    Thompson(const FlatRegex &f, FlatRegex::Node root, const ByteClasses &a)
+        :r(nullptr),reuse(false),flat(&f),flat_root(root),alphabet(a),hint(0){}
+
+    /**
+     * @brief 设置预计的状态数，构建时一次性预留
+     * @param states 预计的状态数
+     */
+    void reserve(size_t states) { hint = states; }
+
+    /**
+     * @brief 交与补是否先物化子表达式的最小DFA再构造完整乘积(默认只探索可达的状态对)
+     */
+    void set_materialize(bool on) { materialize = on; }
+
+    long long product_states() const { return product_states_; } ///< 交与补生成的状态总数
+    double product_ms() const { return product_ms_; }             ///< 交与补的构造耗时(毫秒)
+
+    /**
+     * @brief 构建ε-NFA
+     * @return 构建完成的NFA
+     */
+    NFA build() {
+        nfa = NFA();
+        nfa.alphabet = alphabet;
+        nfa.states.reserve(hint);
+        built.clear();
+        copied = 0;
+        NFAFragment frag = flat?buildFlat():buildFragment(r);
+        nfa.states[frag.accept].accept = true;
+        nfa.start = frag.start;
+        return nfa;
+    }
+
+    /**
+     * @brief 计算Thompson构造将为语法树生成的状态数(不实际构造)
+     * @param root 语法树根节点
+     * @return 状态数，共享节点按出现次数计
+     */
+    static long long count_states(RegexNode* root) {
+        if (!root) return 0;
+        unordered_map<RegexNode*,long long> cnt;
+        vector<pair<RegexNode*,bool>> work;
+        work.push_back({root,false});
+        while (!work.empty()) {
+            RegexNode* node = work.back().first;
+            bool expanded = work.back().second;
+            work.pop_back();
+            if (cnt.count(node)) continue;
+            if (!expanded && !node->leaf()) {
+                work.push_back({node,true});
+                if (node->right) work.push_back({node->right,false});
+                work.push_back({node->left,false});
+                continue;
+            }
+            long long c = node->type==RegexNode::CONCAT?0:2;
+            if (node->type==RegexNode::STRING) c = node->len+1;
+            if (node->type==RegexNode::UCLASS) c = Utf8Automaton::compile(node->code_ranges()).states;
+            if (node->type==RegexNode::REPEAT) {
+                // 与repeat()一致：子片段的副本数，加上可选副本前的分支状态和公共接受态
+                long long m = node->repeat_min(), n = node->repeat_max(), child = cnt[node->left];
+                if (n == 0) c = child+2;
+                else if (n == RegexNode::UNBOUNDED) c = child*(m+1)+2;
+                else c = child*n+(n>m?n-m+1:0);
+                cnt[node] = c;
+                continue;
+            }
+            if (node->left) c += cnt[node->left];
+            if (node->right) c += cnt[node->right];
+            cnt[node] = c;
+        }
+        return cnt[root];
+    }
+private:
+    /**
+     * @brief 已构建节点的片段记录；片段的状态编号连续，位于[lo,hi)
+     */
+    struct BuiltFragment {
+        int lo, hi;        ///< 片段状态编号区间
+        NFAFragment frag;  ///< 片段本身
+    };
+
+    RegexNode *r; ///< 正则表达式语法树根节点
+    bool reuse;   ///< 是否复用共享节点的片段
+    const FlatRegex *flat;   ///< 扁平语法树(为空时使用指针树)
+    FlatRegex::Node flat_root; ///< 扁平语法树的根节点下标
+    const ByteClasses &alphabet; ///< 输入字母表
+    size_t hint;               ///< 预计的状态数
+    bool materialize = false;  ///< 交与补是否使用物化的完整乘积
+    long long product_states_ = 0; ///< 交与补生成的状态总数
+    double product_ms_ = 0;        ///< 交与补的构造耗时
+    long long copied = 0;          ///< 重复展开已复制出的状态数
+    NFA nfa;       ///< 构造中的NFA
+    unordered_map<RegexNode*,BuiltFragment> built; ///< 节点 -> 已构建的片段
+
+    /**
+     * @brief 添加状态转移
+     * @param from 源状态
+     * @param to 目标状态
+     * @param c 转移符号(字节等价类编号或EPS)
+     */
+    void add_transition(int from, int to, int c) {
+        nfa.states[from].trans[c].push_back(to);
+    }
+
+    /**
+     * @brief 针对给定正则节点构建NFA片段
+     *
+     * 复用模式下，同一节点再次出现时不再遍历其子树，而是整体复制该节点第一次
+     * 构建出的状态区间。片段完成后外层只会添加从区间内指向区间外的转移，
+     * 因此只保留区间内部的转移即可还原片段完成时的形状。
+     * @param root 正则节点
+     * @return 对应的NFAFragment
+     */
+    NFAFragment buildFragment(RegexNode* root) {
+        struct WorkItem {
+            RegexNode* node; ///< 待处理节点
+            bool expanded;   ///< 子节点是否已处理
+            int lo;          ///< 展开时的状态数，即片段区间起点
+        };
+        vector<WorkItem> work;
+        vector<NFAFragment> frags; // 已完成的子片段
+        work.push_back({root,false,0});
+        while (!work.empty()) {
+            WorkItem w = work.back();
+            work.pop_back();
+            if (!w.expanded) {
+                if (reuse) {
+                    auto it = built.find(w.node);
+                    if (it!=built.end()) {
+                        frags.push_back(clone(it->second));
+                        continue;
+                    }
+                }
+                if (!w.node->leaf()) {
+                    work.push_back({w.node,true,(int)nfa.states.size()});
+                    if (w.node->right) work.push_back({w.node->right,false,0});
+                    work.push_back({w.node->left,false,0});
+                    continue;
+                }
+                w.lo = (int)nfa.states.size();
+            }
+            frags.push_back(combine(w.node,frags,w.lo));
+            if (reuse) built[w.node] = {w.lo,(int)nfa.states.size(),frags.back()};
+        }
+        return frags.back();
+    }
+
+    /**
+     * @brief 复制一个已构建的片段
+     * @param b 已构建片段的记录
+     * @return 新片段
+     */
+    NFAFragment clone(const BuiltFragment &b) {
+        int off = (int)nfa.states.size()-b.lo;
+        for (int i=b.lo; i<b.hi; i++) {
+            int ns = nfa.new_state();
+            for (auto &kv: nfa.states[i].trans) {
+                for (int t: kv.second) {
+                    if (t>=b.lo && t<b.hi) add_transition(ns,t+off,kv.first);
+                }
+            }
+        }
+        return {b.frag.start+off,b.frag.accept+off};
+    }
+
+    /**
+     * @brief 按后序扫描扁平语法树构建NFA片段，子节点的片段总是先于父节点完成
+     * @return 根节点的NFAFragment
+     */
+    NFAFragment buildFlat() {
+        const FlatRegex &f = *flat;
+        vector<NFAFragment> frag(f.size());
+        vector<int> first(f.size()); // 子树的状态区间起点：子树的状态编号连续
+        for (size_t i=0; i<f.size(); i++) {
+            RegexNode::Type t = (RegexNode::Type)f.type[i];
+            first[i] = (int)nfa.states.size();
+            if (t == RegexNode::STRING || t == RegexNode::CLASS || t == RegexNode::UCLASS) {
+                frag[i] = emit(t,0,&f.text[f.left[i]],(int)f.right[i],{-1,-1},{-1,-1},-1);
+                continue;
+            }
+            if (t == RegexNode::REPEAT) {
+                first[i] = first[f.left[i]];
+                frag[i] = emit(t,0,&f.text[f.right[i]],8,frag[f.left[i]],{-1,-1},first[i]);
+                continue;
+            }
+            if (f.left[i] != FlatRegex::NONE) first[i] = first[f.left[i]];
+            NFAFragment f1 = f.left[i]!=FlatRegex::NONE?frag[f.left[i]]:NFAFragment{-1,-1};
+            NFAFragment f2 = f.right[i]!=FlatRegex::NONE?frag[f.right[i]]:NFAFragment{-1,-1};
+            frag[i] = emit(t,f.ch[i],nullptr,0,f1,f2,first[i]);
+        }
+        return frag[flat_root];
+    }
+
+    /**
+     * @brief 用栈顶的子片段构造节点node的片段
+     * @param node 正则节点
+     * @param frags 子片段栈，右子片段位于栈顶
+     * @param lo 节点子树的状态区间起点
+     * @return 对应的NFAFragment
+     */
+    NFAFragment combine(RegexNode* node, vector<NFAFragment> &frags, int lo) {
+        NFAFragment f1{-1,-1}, f2{-1,-1};
+        if (node->right) { f2 = frags.back(); frags.pop_back(); }
+        if (node->left) { f1 = frags.back(); frags.pop_back(); }
+        return emit(node->type,node->ch,node->text,node->len,f1,f2,lo);
+    }
+
+    /**
+     * @brief 把状态区间[lo,hi)中的片段取出为独立的ε-NFA，区间外的转移被忽略
+     * @param lo 区间起点
+     * @param hi 区间终点
+     * @param f 片段，其状态位于区间内
+     * @return 状态重新从0编号的ε-NFA，f的接受态为唯一的接受态
+     */
+    NFA extract(int lo, int hi, NFAFragment f) const {
+        NFA sub;
+        sub.alphabet = alphabet;
+        sub.states.resize(hi-lo);
+        for (int i=lo; i<hi; i++) {
+            sub.states[i-lo].id = i-lo;
+            for (auto &kv: nfa.states[i].trans) {
+                for (int t: kv.second) {
+                    if (t>=lo && t<hi) sub.states[i-lo].trans[kv.first].push_back(t-lo);
+                }
+            }
+        }
+        sub.start = f.start-lo;
+        sub.states[f.accept-lo].accept = true;
+        return sub;
+    }
+
+    /**
+     * @brief 把一个(可能有多个接受态的)自动机整体复制为片段：
+     *        新建起始态与接受态，分别用ε转移连到原起始态和各接受态
+     * @param a 待复制的自动机
+     * @return 对应的NFAFragment
+     */
+    NFAFragment embed(const NFA &a) {
+        int base = (int)nfa.states.size();
+        for (size_t i=0; i<a.states.size(); i++) nfa.new_state();
+        for (size_t i=0; i<a.states.size(); i++) {
+            for (auto &kv: a.states[i].trans) {
+                for (int t: kv.second) add_transition(base+(int)i,base+t,kv.first);
+            }
+        }
+        int s = nfa.new_state();
+        int acc = nfa.new_state();
+        add_transition(s,base+a.start,EPS);
+        for (size_t i=0; i<a.states.size(); i++) {
+            if (a.states[i].accept) add_transition(base+(int)i,acc,EPS);
+        }
+        return {s,acc};
+    }
+
+    /**
+     * @brief 构造交或补的片段，定义在ProductConstruction之后
+     * @param type AND或NOT
+     * @param f1 左子片段(NOT的唯一子片段)
+     * @param f2 右子片段
+     * @param lo 子片段所在状态区间的起点，区间终点为当前状态数
+     * @return 对应的NFAFragment
+     */
+    NFAFragment boolean(RegexNode::Type type, NFAFragment f1, NFAFragment f2, int lo);
+
+    /**
+     * @brief 构造有界重复r{m,n}的片段：r的片段刚刚构建完毕，位于状态区间[lo, 当前状态数)，
+     *        其余副本整体复制该区间，而不是重新遍历r的子树
+     *
+     * r{m,n}展开为m个必选副本之后接n-m个可选副本，每个可选副本前有一个分支状态，
+     * 可以直接跳到公共接受态；r{m,}为m个必选副本之后接一个副本的闭包。
+     * @param f1 r的片段
+     * @param lo r的状态区间起点
+     * @param m 下界
+     * @param n 上界，或RegexNode::UNBOUNDED
+     * @return 对应的NFAFragment
+     * @throw RegexError 复制出的状态总数超过REPEAT_LIMIT
+     */
+    NFAFragment repeat(NFAFragment f1, int lo, int m, int n) {
+        if (n == 0) return emit(RegexNode::EPSILON,0,nullptr,0,{-1,-1},{-1,-1},-1);
+        BuiltFragment child{lo,(int)nfa.states.size(),f1};
+        long long copies = n==RegexNode::UNBOUNDED?m:n-1;
+        copied += copies*(child.hi-child.lo);
+        if (copied > REPEAT_LIMIT) {
+            throw RegexError("repetition expands to more than "+to_string((int)REPEAT_LIMIT)+" NFA states");
+        }
+        int used = 0;
+        auto next_copy = [&]() { return used++==0?f1:clone(child); };
+        NFAFragment cur{-1,-1};
+        auto append = [&](NFAFragment f) {
+            if (cur.start < 0) {
+                cur = f;
+            } else {
+                add_transition(cur.accept,f.start,EPS);
+                cur.accept = f.accept;
+            }
+        };
+        for (int i=0; i<m; i++) append(next_copy());
+        if (n == RegexNode::UNBOUNDED) {
+            append(emit(RegexNode::STAR,0,nullptr,0,next_copy(),{-1,-1},-1));
+            return cur;
+        }
+        if (n > m) {
+            vector<int> skips;
+            for (int i=m; i<n; i++) {
+                int p = nfa.new_state();
+                append({p,p});
+                skips.push_back(p);
+                append(next_copy());
+            }
+            int a = nfa.new_state();
+            append({a,a});
+            for (int p: skips) add_transition(p,a,EPS);
+        }
+        return cur;
+    }
+
+    /**
+     * @brief 由节点内容及其子片段构造NFA片段
+     * @param type 节点类型
+     * @param ch CHAR节点的字符
+     * @param text STRING节点的字面量，CLASS节点的位图，UCLASS节点的码点区间，或REPEAT节点的上下界
+     * @param len text的长度
+     * @param f1 左子片段(STAR、REPEAT的唯一子片段)
+     * @param f2 右子片段
+     * @param lo 节点子树的状态区间起点(REPEAT、AND、NOT使用)
+     * @return 对应的NFAFragment
+     */
+    NFAFragment emit(RegexNode::Type type, char ch, const char* text, int len,
+                     NFAFragment f1, NFAFragment f2, int lo) {
+        switch(type) {
+            case RegexNode::CHAR: {
+                int s = nfa.new_state();
+                int a = nfa.new_state();
+                add_transition(s,a,alphabet.of((unsigned char)ch));
+                return {s,a};
+            }
+            case RegexNode::CLASS: {
+                // 字符类与每个等价类要么相交为空、要么包含整个类，每个被包含的类一条边
+                ByteSet set = ByteSet::from_bits(text);
+                int s = nfa.new_state();
+                int a = nfa.new_state();
+                for (int c=0; c<alphabet.size(); c++) {
+                    if (set.has(alphabet.representative(c))) add_transition(s,a,c);
+                }
+                return {s,a};
+            }
+            case RegexNode::UCLASS: {
+                // 码点类编译为最小的UTF-8字节层自动机，各状态连续分配
+                Utf8Automaton u = Utf8Automaton::compile(decode_code_ranges(text,len));
+                int base = (int)nfa.states.size();
+                for (int k=0; k<u.states; k++) nfa.new_state();
+                for (auto &e: u.edges) {
+                    for (int c=0; c<alphabet.size(); c++) {
+                        unsigned char b = alphabet.representative(c);
+                        if (b >= e.lo && b <= e.hi) add_transition(base+e.from,base+e.to,c);
+                    }
+                }
+                return {base+u.start,base+u.accept};
+            }
+            case RegexNode::EPSILON: {
+                int s = nfa.new_state();
+                int a = nfa.new_state();
+                add_transition(s,a,EPS);
+                return {s,a};
+            }
+            case RegexNode::STRING: {
+                // 字面量串直接生成一条状态链，不需要ε转移
+                int s = nfa.new_state();
+                int cur = s;
+                for (int i=0; i<len; i++) {
+                    int nxt = nfa.new_state();
+                    add_transition(cur,nxt,alphabet.of((unsigned char)text[i]));
+                    cur = nxt;
+                }
+                return {s,cur};
+            }
+            case RegexNode::REPEAT:
+                return repeat(f1,lo,RegexNode::decode_bound(text),RegexNode::decode_bound(text+4));
+            case RegexNode::AND:
+            case RegexNode::NOT:
+                return boolean(type,f1,f2,lo);
+            case RegexNode::CONCAT: {
+                add_transition(f1.accept,f2.start,EPS);
+                return {f1.start,f2.accept};
+            }
+            case RegexNode::UNION: {
+                int s = nfa.new_state();
+                int a = nfa.new_state();
+                add_transition(s,f1.start,EPS);
+                add_transition(s,f2.start,EPS);
+                add_transition(f1.accept,a,EPS);
+                add_transition(f2.accept,a,EPS);
+                return {s,a};
+            }
+            case RegexNode::STAR: {
+                int s = nfa.new_state();
+                int a = nfa.new_state();
+                add_transition(s,f1.start,EPS);
+                add_transition(f1.accept,a,EPS);
+                add_transition(s,a,EPS);
+                // 回边指向外层的s而不是f1.start，使子片段内部不再新增转移
+                add_transition(f1.accept,s,EPS);
+                return {s,a};
+            }
+        }
+        return {-1,-1};
+    }
+};
+
+//-------------------- Glushkov构造 --------------------
+
+/**
+ * @brief 使用Glushkov构造(位置自动机)将语法树直接转换为无ε转移的NFA
+ *
+ * 每个字面量位置(CHAR、STRING中的每个字节、CLASS)对应一个状态，另加起始态0。
+ * 按后序计算每个子表达式的first/last集合与是否可空：连接与闭包把last中的
+ * 各位置连到first中的各位置，边的符号是目标位置所接受的字节等价类。
+ * 结果不含ε转移，可以跳过EpsilonRemover直接做子集构造。
+ *
+ * 重复r{m,n}复制r刚构建完的位置区间，与Thompson::repeat相同，复制总数同样以Thompson::REPEAT_LIMIT为上限。
+ * 交、补与Unicode码点类没有单个位置的表示，supports()为假时应改用Thompson构造。
+ */
+class Glushkov {
+public:
+    /**
+     * @brief 构造函数
+     * @param root 正则表达式语法树的根节点(共享子树按出现次数分别生成位置)
+     * @param a 输入字母表，须已收集该语法树中的所有字节
+     */
+    Glushkov(RegexNode* root, const ByteClasses &a)
+        :r(root),flat(nullptr),flat_root(FlatRegex::NONE),alphabet(a){}
+
+    /**
+     * @brief 构造函数
+     * @param f 扁平语法树
+     * @param root 根节点下标
+     * @param a 输入字母表，须已收集该语法树中的所有字节
+     */
+    Glushkov(const FlatRegex &f, FlatRegex::Node root, const ByteClasses &a)
+        :r(nullptr),flat(&f),flat_root(root),alphabet(a){}
+
+    /**
+     * @brief 语法树是否只含Glushkov构造支持的节点(不含AND、NOT、UCLASS)
+     */
+    template<class Tree>
+    static bool supports(const Tree &t) {
+        return !tree_has(t,[](RegexNode::Type x) {
+            return x == RegexNode::AND || x == RegexNode::NOT || x == RegexNode::UCLASS;
+        });
+    }
+
+    /**
+     * @brief 构建无ε转移的NFA
+     * @return 起始态为0、每个位置一个状态的NFA
+     */
+    NFA build() {
+        nfa = NFA();
+        nfa.alphabet = alphabet;
+        sym.clear();
+        copied = 0;
+        new_position({});
+        Summary root = flat?buildFlat():buildTree();
+        nfa.start = 0;
+        connect({0},root.first);
+        for (int p: root.last) nfa.states[p].accept = true;
+        nfa.states[0].accept = root.nullable;
+        // 闭包嵌套时同一条边可能重复加入
+        for (auto &st: nfa.states) {
+            for (auto &kv: st.trans) {
+                sort(kv.second.begin(),kv.second.end());
+                kv.second.erase(unique(kv.second.begin(),kv.second.end()),kv.second.end());
+            }
+        }
+        return nfa;
+    }
+
+private:
+    /**
+     * @brief 子表达式的摘要；其位置状态编号连续，位于[lo, 构建完成时的状态数)
+     */
+    struct Summary {
+        vector<int> first;    ///< 可作为第一个字节的位置
+        vector<int> last;     ///< 可作为最后一个字节的位置
+        bool nullable = true; ///< 是否接受空串
+    };
+
+    RegexNode *r;                ///< 正则表达式语法树根节点
+    const FlatRegex *flat;       ///< 扁平语法树(为空时使用指针树)
+    FlatRegex::Node flat_root;   ///< 扁平语法树的根节点下标
+    const ByteClasses &alphabet; ///< 输入字母表
+    NFA nfa;                     ///< 构造中的NFA
+    long long copied = 0;        ///< 重复展开已复制出的位置数
+    vector<vector<int>> sym;     ///< 每个位置接受的字节等价类
+
+    /**
+     * @brief 新建一个接受给定等价类的位置
+     */
+    int new_position(vector<int> classes) {
+        sym.push_back(move(classes));
+        return nfa.new_state();
+    }
+
+    /**
+     * @brief 从from中的每个位置连边到to中的每个位置
+     */
+    void connect(const vector<int> &from, const vector<int> &to) {
+        for (int p: from) {
+            for (int q: to) {
+                for (int c: sym[q]) nfa.states[p].trans[c].push_back(q);
+            }
+        }
+    }
+
+    /**
+     * @brief 连接两个子表达式的摘要
+     */
+    Summary concat(Summary a, Summary b) {
+        connect(a.last,b.first);
+        Summary s;
+        s.first = move(a.first);
+        if (a.nullable) s.first.insert(s.first.end(),b.first.begin(),b.first.end());
+        s.last = move(b.last);
+        if (b.nullable) s.last.insert(s.last.end(),a.last.begin(),a.last.end());
+        s.nullable = a.nullable && b.nullable;
+        return s;
+    }
+
+    /**
+     * @brief 闭包
+     */
+    Summary star(Summary a) {
+        connect(a.last,a.first);
+        a.nullable = true;
+        return a;
+    }
+
+    /**
+     * @brief 复制位置区间[lo,hi)及区间内部的边
+     * @param lo 区间起点
+     * @param hi 区间终点
+     * @param a 区间对应的摘要
+     * @return 副本的摘要
+     */
+    Summary clone(int lo, int hi, const Summary &a) {
+        int off = (int)nfa.states.size()-lo;
+        for (int i=lo; i<hi; i++) {
+            int ns = new_position(sym[i]);
+            for (auto &kv: nfa.states[i].trans) {
+                for (int t: kv.second) {
+                    if (t>=lo && t<hi) nfa.states[ns].trans[kv.first].push_back(t+off);
+                }
+            }
+        }
+        Summary s = a;
+        for (int &p: s.first) p += off;
+        for (int &p: s.last) p += off;
+        return s;
+    }
+
+    /**
+     * @brief 重复r{m,n}：r的位置刚刚构建完毕，位于[lo, 当前状态数)
+     *
+     * 先复制出全部副本再连接，使每次复制的区间内只有r自身的边。
+     * @throw RegexError 复制出的位置总数超过Thompson::REPEAT_LIMIT
+     */
+    Summary repeat(Summary a, int lo, int m, int n) {
+        if (n == 0) return Summary();
+        int hi = (int)nfa.states.size();
+        int copies = n==RegexNode::UNBOUNDED?m+1:n;
+        copied += (long long)(copies-1)*(hi-lo);
+        if (copied > Thompson::REPEAT_LIMIT) {
+            throw RegexError("repetition expands to more than "+to_string((int)Thompson::REPEAT_LIMIT)+" positions");
+        }
+        vector<Summary> parts{a};
+        for (int i=1; i<copies; i++) parts.push_back(clone(lo,hi,a));
+        if (n == RegexNode::UNBOUNDED) parts.back() = star(move(parts.back()));
+        for (int i=m; i<copies; i++) parts[i].nullable = true;
+        Summary s = move(parts[0]);
+        for (int i=1; i<copies; i++) s = concat(move(s),move(parts[i]));
+        return s;
+    }
+
+    /**
+     * @brief 由节点内容及其子摘要构造摘要
+     * @param type 节点类型
+     * @param ch CHAR节点的字符
+     * @param text STRING节点的字面量，CLASS节点的位图，或REPEAT节点的上下界
+     * @param len text的长度
+     * @param a 左子摘要(STAR、REPEAT的唯一子摘要)
+     * @param b 右子摘要
+     * @param lo 节点子树的位置区间起点(REPEAT使用)
+     */
+    Summary emit(RegexNode::Type type, char ch, const char* text, int len, Summary a, Summary b, int lo) {
+        Summary s;
+        switch (type) {
+            case RegexNode::CHAR: {
+                int p = new_position({alphabet.of((unsigned char)ch)});
+                s.first = s.last = {p};
+                s.nullable = false;
+                return s;
+            }
+            case RegexNode::CLASS: {
+                ByteSet set = ByteSet::from_bits(text);
+                vector<int> classes;
+                for (int c=0; c<alphabet.size(); c++) {
+                    if (set.has(alphabet.representative(c))) classes.push_back(c);
+                }
+                int p = new_position(move(classes));
+                s.first = s.last = {p};
+                s.nullable = false;
+                return s;
+            }
+            case RegexNode::STRING: {
+                // 字面量串的位置依次相连
+                int prev = -1;
+                for (int i=0; i<len; i++) {
+                    int p = new_position({alphabet.of((unsigned char)text[i])});
+                    if (prev < 0) s.first = {p};
+                    else connect({prev},{p});
+                    prev = p;
+                }
+                s.last = {prev};
+                s.nullable = false;
+                return s;
+            }
+            case RegexNode::EPSILON:
+                return s;
+            case RegexNode::CONCAT:
+                return concat(move(a),move(b));
+            case RegexNode::UNION:
+                s.first = move(a.first);
+                s.first.insert(s.first.end(),b.first.begin(),b.first.end());
+                s.last = move(a.last);
+                s.last.insert(s.last.end(),b.last.begin(),b.last.end());
+                s.nullable = a.nullable || b.nullable;
+                return s;
+            case RegexNode::STAR:
+                return star(move(a));
+            case RegexNode::REPEAT:
+                return repeat(move(a),lo,RegexNode::decode_bound(text),RegexNode::decode_bound(text+4));
+            default:
+                throw logic_error("unsupported node in Glushkov construction");
+        }
+    }
+
+    /**
+     * @brief 以显式栈后序遍历指针树
+     */
+    Summary buildTree() {
+        struct WorkItem {
+            RegexNode* node; ///< 待处理节点
+            bool expanded;   ///< 子节点是否已处理
+            int lo;          ///< 展开时的状态数，即位置区间起点
+        };
+        vector<WorkItem> work{{r,false,0}};
+        vector<Summary> done; // 已完成的子摘要
+        while (!work.empty()) {
+            WorkItem w = work.back();
+            work.pop_back();
+            if (!w.expanded && !w.node->leaf()) {
+                work.push_back({w.node,true,(int)nfa.states.size()});
+                if (w.node->right) work.push_back({w.node->right,false,0});
+                work.push_back({w.node->left,false,0});
+                continue;
+            }
+            Summary a, b;
+            if (!w.node->leaf()) {
+                if (w.node->right) { b = move(done.back()); done.pop_back(); }
+                a = move(done.back()); done.pop_back();
+            }
+            RegexNode* n = w.node;
+            done.push_back(emit(n->type,n->ch,n->text,n->len,move(a),move(b),w.lo));
+        }
+        return move(done.back());
+    }
+
+    /**
+     * @brief 按后序扫描扁平语法树
+     */
+    Summary buildFlat() {
+        const FlatRegex &f = *flat;
+        vector<Summary> sum(f.size());
+        vector<int> first(f.size()); // 子树的位置区间起点
+        for (size_t i=0; i<f.size(); i++) {
+            RegexNode::Type t = (RegexNode::Type)f.type[i];
+            first[i] = (int)nfa.states.size();
+            if (t == RegexNode::STRING || t == RegexNode::CLASS) {
+                sum[i] = emit(t,0,&f.text[f.left[i]],(int)f.right[i],Summary(),Summary(),-1);
+                continue;
+            }
+            if (t == RegexNode::REPEAT) {
+                first[i] = first[f.left[i]];
+                sum[i] = emit(t,0,&f.text[f.right[i]],8,move(sum[f.left[i]]),Summary(),first[i]);
+                continue;
+            }
+            if (f.left[i] != FlatRegex::NONE) first[i] = first[f.left[i]];
+            Summary a = f.left[i]!=FlatRegex::NONE?move(sum[f.left[i]]):Summary();
+            Summary b = f.right[i]!=FlatRegex::NONE?move(sum[f.right[i]]):Summary();
+            sum[i] = emit(t,f.ch[i],nullptr,0,move(a),move(b),first[i]);
+        }
+        return move(sum[flat_root]);
+    }
+};
+
+//-------------------- 互模拟划分 --------------------
+
+/**
+ * @brief 求带标记的转移系统的最粗互模拟划分(Paige–Tarjan)
+ *
+ * 维护两层划分：细划分Q与粗划分X，Q的每块都包含于X的某一块，并且Q相对X的
+ * 每一块稳定。每次从含有两个以上Q块的X块S中取出较小的Q块B单独成为X块，
+ * 再按每个符号a用B和S-B细分Q：先分出有a转移进入B的状态，再从中分出进入S
+ * 的a转移全部落在B中的状态。每个(状态, 符号, X块)记一个计数，即该状态在该符号上
+ * 进入该X块的转移数，第二步只需看进入S-B的计数是否减到0。每个状态所在的B
+ * 至多是上一次的一半，共O(m log n)。ε转移(EPS)与其他符号一样处理。
+ */
+class BisimulationRefiner {
+public:
+    /**
+     * @brief 求最粗的互模拟划分
+     * @param n 状态数
+     * @param initial initial[s]为状态s的初始块，只有初始块相同的状态才会在同一块中
+     * @param edges 全部转移
+     * @return block[s]为状态s所在的块，按块中最小的状态编号依次为0,1,2...
+     */
+    static vector<int> coarsest(int n, const vector<int> &initial, const vector<FrozenNFA::Edge> &edges) {
+        BisimulationRefiner r(n,edges);
+        return r.run(initial);
+    }
+
+private:
+    /**
+     * @brief Q的一块：elems[begin,end)，其中前marked个已被标记
+     */
+    struct Block {
+        int begin, end, marked;
+        int compound; ///< 所在的X块
+    };
+
+    /**
+     * @brief 一条转移
+     */
+    struct Arc {
+        int from, symbol;
+        int count; ///< (from, symbol, 目标所在X块)的计数编号
+    };
+
+    int n;
+    vector<int> elems, pos, blk;       ///< 按块排列的状态、状态在elems中的位置、状态所在的Q块
+    vector<Block> blocks;              ///< Q的各块
+    vector<vector<int>> compounds;     ///< X的各块包含的Q块
+    vector<int> pending;               ///< 含有两个以上Q块的X块(可能已过时)
+    vector<int> touched;               ///< 本轮有状态被标记的Q块
+    vector<Arc> arcs;                  ///< 全部转移，按目标、符号排列
+    vector<int> in_first;              ///< 目标为s的转移为arcs[in_first[s] .. in_first[s+1])
+    vector<int> count;                 ///< 各计数的值
+
+    BisimulationRefiner(int n, const vector<FrozenNFA::Edge> &edges)
+        :n(n),elems(n),pos(n),blk(n),in_first(n+1,0) {
+        for (auto &e: edges) in_first[e.to+1]++;
+        for (int s=0; s<n; s++) in_first[s+1] += in_first[s];
+        arcs.resize(edges.size());
+        vector<int> fill(in_first.begin(),in_first.end()-1);
+        for (auto &e: edges) arcs[fill[e.to]++] = {e.from,e.symbol,-1};
+        for (int s=0; s<n; s++) {
+            sort(arcs.begin()+in_first[s],arcs.begin()+in_first[s+1],[](const Arc &x, const Arc &y) {
+                return x.symbol<y.symbol;
+            });
+        }
+    }
+
+    vector<int> run(const vector<int> &initial) {
+        // 初始划分：按initial分块，全部位于同一个X块中
+        iota(elems.begin(),elems.end(),0);
+        stable_sort(elems.begin(),elems.end(),[&](int x, int y) { return initial[x]<initial[y]; });
+        compounds.emplace_back();
+        for (int i=0; i<n; i++) {
+            pos[elems[i]] = i;
+            if (i==0 || initial[elems[i]]!=initial[elems[i-1]]) {
+                compounds[0].push_back((int)blocks.size());
+                blocks.push_back({i,i,0,0});
+            }
+            blocks.back().end = i+1;
+            blk[elems[i]] = (int)blocks.size()-1;
+        }
+
+        // 相对整个状态集稳定：按每个符号上有没有转移细分；每个(状态, 符号)一个计数
+        vector<int> order(arcs.size());
+        iota(order.begin(),order.end(),0);
+        sort(order.begin(),order.end(),[&](int x, int y) {
+            return make_pair(arcs[x].symbol,arcs[x].from)<make_pair(arcs[y].symbol,arcs[y].from);
+        });
+        for (size_t i=0; i<order.size(); i++) {
+            Arc &a = arcs[order[i]];
+            Arc *prev = i>0?&arcs[order[i-1]]:nullptr;
+            if (!prev || prev->symbol!=a.symbol || prev->from!=a.from) {
+                a.count = (int)count.size();
+                count.push_back(0);
+                mark(a.from);
+            } else {
+                a.count = prev->count;
+            }
+            count[a.count]++;
+            if (i+1==order.size() || arcs[order[i+1]].symbol!=a.symbol) split();
+        }
+        if (compounds[0].size()>1) pending.push_back(0);
+
+        vector<int> fresh(n,-1), stale(n,-1), sources, states;
+        vector<int> in;
+        while (!pending.empty()) {
+            int x = pending.back();
+            vector<int> &qs = compounds[x];
+            if (qs.size()<2) { pending.pop_back(); continue; }
+            // 取前两块中较小的一块B，它不超过S的一半
+            int i = size_of(qs[1])<size_of(qs[0])?1:0;
+            int b = qs[i];
+            qs[i] = qs.back();
+            qs.pop_back();
+            if (qs.size()<2) pending.pop_back();
+            blocks[b].compound = (int)compounds.size();
+            compounds.push_back({b});
+
+            states.assign(elems.begin()+blocks[b].begin,elems.begin()+blocks[b].end);
+            in.clear();
+            for (int s: states) {
+                for (int k=in_first[s]; k<in_first[s+1]; k++) in.push_back(k);
+            }
+            stable_sort(in.begin(),in.end(),[&](int p, int q) { return arcs[p].symbol<arcs[q].symbol; });
+            for (size_t lo=0; lo<in.size(); ) {
+                size_t hi = lo;
+                while (hi<in.size() && arcs[in[hi]].symbol==arcs[in[lo]].symbol) hi++;
+                // 第一步：有该符号的转移进入B的状态；转移改记到(状态, 符号, B)的计数上
+                for (size_t k=lo; k<hi; k++) {
+                    Arc &a = arcs[in[k]];
+                    if (fresh[a.from]<0) {
+                        fresh[a.from] = (int)count.size();
+                        count.push_back(0);
+                        stale[a.from] = a.count;
+                        sources.push_back(a.from);
+                    }
+                    count[a.count]--;
+                    count[fresh[a.from]]++;
+                    a.count = fresh[a.from];
+                    mark(a.from);
+                }
+                split();
+                // 第二步：其中没有该符号的转移进入S-B的状态
+                for (int s: sources) {
+                    if (count[stale[s]]==0) mark(s);
+                }
+                split();
+                for (int s: sources) fresh[s] = -1;
+                sources.clear();
+                lo = hi;
+            }
+        }
+
+        vector<int> id(blocks.size(),-1), block(n);
+        int m = 0;
+        for (int s=0; s<n; s++) {
+            if (id[blk[s]]<0) id[blk[s]] = m++;
+            block[s] = id[blk[s]];
+        }
+        return block;
+    }
+
+    int size_of(int b) const { return blocks[b].end-blocks[b].begin; }
+
+    /**
+     * @brief 标记状态s：移到所在块的已标记部分
+     */
+    void mark(int s) {
+        Block &b = blocks[blk[s]];
+        int p = pos[s], q = b.begin+b.marked;
+        if (p<q) return;
+        if (b.marked++==0) touched.push_back(blk[s]);
+        int t = elems[q];
+        elems[q] = s; pos[s] = q;
+        elems[p] = t; pos[t] = p;
+    }
+
+    /**
+     * @brief 把有状态被标记的块分成已标记和未标记的两块，并清除标记
+     */
+    void split() {
+        for (int b: touched) {
+            int m = blocks[b].marked;
+            blocks[b].marked = 0;
+            if (m==size_of(b)) continue;
+            int nb = (int)blocks.size(), x = blocks[b].compound;
+            blocks.push_back({blocks[b].begin,blocks[b].begin+m,0,x});
+            blocks[b].begin += m;
+            for (int i=blocks[nb].begin; i<blocks[nb].end; i++) blk[elems[i]] = nb;
+            compounds[x].push_back(nb);
+            if (compounds[x].size()==2) pending.push_back(x);
+        }
+        touched.clear();
+    }
+};
+
+//-------------------- NFA压缩 --------------------
+
+/**
+ * @brief 在不改变语言的前提下合并NFA中的状态，两个步骤都先删去从起始态不可达的状态
+ *
+ * contract_epsilon()收缩Thompson构造产生的ε链：
+ * - 唯一出边是ε转移u->v的非接受态u并入v(两者的语言相同)；
+ * - 唯一入边是ε转移u->v的非起始态v并入u(v只能经由u到达)。
+ * merge_equivalent()合并接受性与全部出边(目标按合并结果计)都相同的状态，
+ * 即按最粗的互模拟划分一次求出，不再逐层反复合并；
+ * 作用于Glushkov位置自动机时，follow集合与是否为末位置都相同的位置被合并，
+ * 结果不大于follow自动机。
+ */
+class NFACompactor {
+public:
+    /**
+     * @brief 收缩ε链
+     * @param a 输入的ε-NFA
+     * @return 语言相同的ε-NFA
+     */
+    static NFA contract_epsilon(const NFA &a) {
+        int n = (int)a.states.size();
+        vector<bool> live = reachable(a);
+
+        // 唯一出边为ε的状态并入其后继，沿链找到终点
+        vector<int> next(n,-1);
+        for (int u=0; u<n; u++) {
+            const NFA::State &st = a.states[u];
+            if (!live[u] || st.accept || st.trans.size()!=1) continue;
+            auto it = st.trans.find(EPS);
+            if (it!=st.trans.end() && it->second.size()==1 && it->second[0]!=u) next[u] = it->second[0];
+        }
+        NFA b = quotient(a,resolve(next,live));
+
+        // 唯一入边为ε的状态并入其前驱，沿链找到起点
+        n = (int)b.states.size();
+        vector<int> indeg(n,0), owner(n,-1);
+        for (int u=0; u<n; u++) {
+            for (auto &kv: b.states[u].trans) {
+                for (int v: kv.second) {
+                    if (++indeg[v]==1 && kv.first==EPS && v!=u) owner[v] = u;
+                    else owner[v] = -1;
+                }
+            }
+        }
+        for (int v=0; v<n; v++) {
+            if (indeg[v]!=1 || v==b.start) owner[v] = -1;
+        }
+        return quotient(b,resolve(owner,vector<bool>(n,true)));
+    }
+
+    /**
+     * @brief 合并接受性与出边(目标按合并结果计)都相同的状态，即按最粗的互模拟合并
+     * @param a 输入的NFA(可以含ε转移)
+     * @return 语言相同的NFA
+     */
+    static NFA merge_equivalent(const NFA &a) {
+        NFA cur = quotient(a,resolve(vector<int>(a.states.size(),-1),reachable(a)));
+        int n = (int)cur.states.size();
+        vector<int> initial(n);
+        vector<FrozenNFA::Edge> es;
+        for (int s=0; s<n; s++) {
+            initial[s] = cur.states[s].accept;
+            for (auto &kv: cur.states[s].trans) {
+                for (int t: kv.second) es.push_back({s,kv.first,t});
+            }
+        }
+        vector<int> block = BisimulationRefiner::coarsest(n,initial,es);
+        // 每块以其中最小的状态为代表
+        vector<int> first(n,-1), rep(n);
+        for (int s=0; s<n; s++) {
+            if (first[block[s]]<0) first[block[s]] = s;
+            rep[s] = first[block[s]];
+        }
+        return quotient(cur,rep);
+    }
+
+private:
+    /**
+     * @brief 从起始态可达的状态
+     */
+    static vector<bool> reachable(const NFA &a) {
+        vector<bool> seen(a.states.size(),false);
+        vector<int> work{a.start};
+        seen[a.start] = true;
+        while (!work.empty()) {
+            int u = work.back();
+            work.pop_back();
+            for (auto &kv: a.states[u].trans) {
+                for (int v: kv.second) {
+                    if (!seen[v]) { seen[v] = true; work.push_back(v); }
+                }
+            }
+        }
+        return seen;
+    }
+
+    /**
+     * @brief 沿link链求每个状态的代表(链的终点)，环上的链在回到已走过的状态处截断
+     * @param link link[s]为s并入的状态，-1表示不并入
+     * @param live 是否保留该状态
+     * @return rep[s]为代表状态，删去的状态为-1
+     */
+    static vector<int> resolve(vector<int> link, const vector<bool> &live) {
+        int n = (int)link.size();
+        vector<int> rep(n,-2); // -2: 尚未求出
+        vector<int> path;
+        for (int s=0; s<n; s++) {
+            if (!live[s]) { rep[s] = -1; continue; }
+            int u = s;
+            while (rep[u]==-2 && link[u]>=0) {
+                rep[u] = -3; // 正在当前链上
+                path.push_back(u);
+                u = link[u];
+            }
+            int end = rep[u]>=0?rep[u]:u;
+            if (rep[u]==-3) link[u] = -1; // 回到了当前链上，环在u处截断
+            rep[u] = end;
+            for (int p: path) rep[p] = end;
+            path.clear();
+        }
+        return rep;
+    }
+
+    /**
+     * @brief 按代表合并状态，代表按原编号顺序重新编号；合并后的ε自环被删去
+     * @param a 输入的NFA
+     * @param rep 每个状态的代表，-1表示删去
+     */
+    static NFA quotient(const NFA &a, const vector<int> &rep) {
+        int n = (int)a.states.size();
+        vector<int> id(n,-1);
+        NFA b;
+        b.alphabet = a.alphabet;
+        for (int s=0; s<n; s++) {
+            if (rep[s]>=0 && id[rep[s]]<0) id[rep[s]] = b.new_state();
+        }
+        for (int s=0; s<n; s++) {
+            if (rep[s]<0) continue;
+            NFA::State &to = b.states[id[rep[s]]];
+            to.accept = to.accept || a.states[s].accept;
+            for (auto &kv: a.states[s].trans) {
+                for (int t: kv.second) {
+                    if (rep[t]<0 || (kv.first==EPS && rep[t]==rep[s])) continue;
+                    to.trans[kv.first].push_back(id[rep[t]]);
+                }
+            }
+        }
+        for (auto &st: b.states) {
+            for (auto &kv: st.trans) {
+                sort(kv.second.begin(),kv.second.end());
+                kv.second.erase(unique(kv.second.begin(),kv.second.end()),kv.second.end());
+            }
+        }
+        b.start = id[rep[a.start]];
+        return b;
+    }
+};
+
+//-------------------- NFA状态重排 --------------------
+
+/**
+ * @brief 按遍历顺序重新编号NFA的状态
+ *
+ * Thompson构造按创建顺序编号，UNION、STAR片段的入口和出口与相邻状态相距很远。
+ * 从起始态按BFS或DFS(先序)的顺序编号后，求闭包和move_set时相继访问的状态
+ * 在内存中靠得更近。每个状态的邻居依次为ε转移和各字节等价类上的转移；
+ * 不可达的状态按原来的顺序排在最后。
+ */
+class NFARenumberer {
+public:
+    enum Order { CREATION, BFS, DFS }; ///< 编号顺序：保持创建顺序、广度优先、深度优先
+
+    /**
+     * @brief 编号顺序的名称，即--renumber=的取值
+     */
+    static const char* order_name(Order o) {
+        static const char* const names[] = {"creation","bfs","dfs"};
+        return names[o];
+    }
+
+    /**
+     * @brief 按给定顺序重新编号
+     * @param a 输入的NFA(可以含ε转移)
+     * @param order 编号顺序
+     * @return 语言相同、只有状态编号不同的NFA
+     */
+    static FrozenNFA renumber(const FrozenNFA &a, Order order) {
+        if (order==CREATION) return a;
+        vector<int> visited = order==BFS?bfs(a):dfs(a);
+        int n = a.size(), next = (int)visited.size();
+        vector<int> id(n,-1);
+        for (int i=0; i<next; i++) id[visited[i]] = i;
+        for (int s=0; s<n; s++) {
+            if (id[s]<0) id[s] = next++;
+        }
+        vector<char> accept(n);
+        for (int s=0; s<n; s++) accept[id[s]] = a.accept[s];
+        vector<FrozenNFA::Edge> es = a.edge_list();
+        for (auto &e: es) { e.from = id[e.from]; e.to = id[e.to]; }
+        return FrozenNFA(a.alphabet,id[a.start],move(accept),es);
+    }
+
+private:
+    /**
+     * @brief 广度优先访问到的可达状态，按访问顺序排列
+     */
+    static vector<int> bfs(const FrozenNFA &a) {
+        vector<bool> seen(a.size(),false);
+        vector<int> queue{a.start};
+        seen[a.start] = true;
+        for (size_t h=0; h<queue.size(); h++) {
+            for (int c=EPS; c<a.alphabet.size(); c++) {
+                for (int t: a.next(queue[h],c)) {
+                    if (!seen[t]) { seen[t] = true; queue.push_back(t); }
+                }
+            }
+        }
+        return queue;
+    }
+
+    /**
+     * @brief 深度优先(先序)访问到的可达状态，按访问顺序排列
+     */
+    static vector<int> dfs(const FrozenNFA &a) {
+        vector<bool> seen(a.size(),false);
+        vector<int> visited, st{a.start};
+        while (!st.empty()) {
+            int u = st.back();
+            st.pop_back();
+            if (seen[u]) continue;
+            seen[u] = true;
+            visited.push_back(u);
+            // 逆序入栈，使第一个邻居最先被访问
+            for (int c=a.alphabet.size()-1; c>=EPS; c--) {
+                FrozenNFA::Targets ts = a.next(u,c);
+                for (const int *t=ts.end(); t!=ts.begin(); ) {
+                    if (!seen[*--t]) st.push_back(*t);
+                }
+            }
+        }
+        return visited;
+    }
+};
+
+//-------------------- ε-NFA -> NFA --------------------
+
+/**
+ * @brief 将ε-NFA转换为无ε转移的NFA
+ *
+ * ε闭包按ε转移图的强连通分量计算：同一分量中的状态ε闭包相同，共用一份；
+ * Tarjan算法按逆拓扑序完成各分量，完成时其后继分量的闭包都已求出，
+ * 分量的闭包即自身的状态并上各后继分量的闭包。每个分量的出边也只求一次，
+ * 再复制给分量中的每个状态。
+ */
+class EpsilonRemover {
+public:
+    /**
+     * @brief 构造函数
+     * @param n 输入的ε-NFA
+     */
+    EpsilonRemover(const FrozenNFA &n):infa(n){}
+
+    /**
+     * @brief 消除ε转移得到无ε的NFA
+     * @return 无ε转移的NFA，状态编号不变
+     */
+    FrozenNFA remove() {
+        int n = infa.size(), k = infa.alphabet.size();
+        compute_closures();
+
+        // 每个分量：是否接受，以及按符号、目标排列的(符号,目标)出边
+        int m = (int)closures.size();
+        vector<char> comp_accept(m,false), done(m,false);
+        vector<vector<pair<int,int>>> out(m);
+        vector<int> stamp(m,-1), targets;
+        int tick = 0;
+        vector<char> accept(n,false);
+        vector<FrozenNFA::Edge> edges;
+        for (int i=0; i<n; i++) {
+            int ci = comp[i];
+            if (!done[ci]) {
+                done[ci] = true;
+                for (int s: closures[ci]) comp_accept[ci] = comp_accept[ci] || infa.accept[s];
+                for (int c=0; c<k; c++) {
+                    targets.clear();
+                    tick++;
+                    for (int s: closures[ci]) {
+                        for (int nxt: infa.next(s,c)) {
+                            int d = comp[nxt];
+                            if (stamp[d]==tick) continue;
+                            stamp[d] = tick;
+                            targets.insert(targets.end(),closures[d].begin(),closures[d].end());
+                        }
+                    }
+                    sort(targets.begin(),targets.end());
+                    targets.erase(unique(targets.begin(),targets.end()),targets.end());
+                    for (int t: targets) out[ci].push_back({c,t});
+                }
+            }
+            accept[i] = comp_accept[ci];
+            for (auto &e: out[ci]) edges.push_back({i,e.first,e.second});
+        }
+
+        return FrozenNFA(infa.alphabet,infa.start,move(accept),edges);
+    }
+
+    /**
+     * @brief ε转移图的强连通分量数(remove()之后有效)
+     */
+    int components() const { return (int)closures.size(); }
+
+private:
+    const FrozenNFA &infa;        ///< 输入的ε-NFA
+    vector<int> comp;             ///< comp[s]为状态s所在的强连通分量
+    vector<vector<int>> closures; ///< 每个强连通分量的ε闭包，升序排列
+
+    /**
+     * @brief 用迭代的Tarjan算法求ε转移图的强连通分量及其闭包
+     */
+    void compute_closures() {
+        int n = infa.size(), counter = 0;
+        comp.assign(n,-1);
+        closures.clear();
+        vector<int> index(n,-1), low(n), st, stamp;
+        vector<char> on_stack(n,false);
+        struct Frame {
+            int u;          ///< 当前状态
+            const int *it;  ///< 下一条待访问的ε转移
+        };
+        vector<Frame> call;
+        auto visit = [&](int v) {
+            index[v] = low[v] = counter++;
+            st.push_back(v);
+            on_stack[v] = true;
+            call.push_back({v,infa.next(v,EPS).begin()});
+        };
+        for (int r=0; r<n; r++) {
+            if (index[r]>=0) continue;
+            visit(r);
+            while (!call.empty()) {
+                int u = call.back().u;
+                if (call.back().it!=infa.next(u,EPS).end()) {
+                    int v = *call.back().it++;
+                    if (index[v]<0) visit(v);
+                    else if (on_stack[v]) low[u] = min(low[u],index[v]);
+                    continue;
+                }
+                call.pop_back();
+                if (!call.empty()) low[call.back().u] = min(low[call.back().u],low[u]);
+                if (low[u]!=index[u]) continue;
+
+                // u是分量的根：弹出分量，闭包为分量中的状态并上各后继分量的闭包
+                int c = (int)closures.size();
+                stamp.push_back(c); // stamp[d]==c：分量d的闭包已并入c(c自身的状态逐个加入)
+                closures.emplace_back();
+                vector<int> &cl = closures[c];
+                size_t first = st.size();
+                do {
+                    first--;
+                    comp[st[first]] = c;
+                    on_stack[st[first]] = false;
+                    cl.push_back(st[first]);
+                } while (st[first]!=u);
+                for (size_t i=first; i<st.size(); i++) {
+                    for (int v: infa.next(st[i],EPS)) {
+                        int d = comp[v];
+                        if (stamp[d]==c) continue;
+                        stamp[d] = c;
+                        cl.insert(cl.end(),closures[d].begin(),closures[d].end());
+                    }
+                }
+                st.resize(first);
+                sort(cl.begin(),cl.end());
+                cl.erase(unique(cl.begin(),cl.end()),cl.end());
+            }
+        }
+    }
+};
+
+//-------------------- NFA约简 --------------------
+
+/**
+ * @brief 删去从起始态不可达、或到达不了任何接受态的状态
+ *
+ * 正向从起始态、反向从全部接受态各做一次遍历，时间与状态数和边数成线性。
+ * 保留的状态按原来的顺序重新编号；语言为空时只留下起始态。
+ */
+class NFATrimmer {
+public:
+    /**
+     * @brief 修剪NFA
+     * @param a 输入的NFA
+     * @return 语言相同、只含有用状态的NFA
+     */
+    static FrozenNFA trim(const FrozenNFA &a) {
+        int n = a.size();
+        vector<FrozenNFA::Edge> es = a.edge_list();
+
+        // 正向可达
+        vector<char> fwd(n,false);
+        vector<int> work{a.start};
+        fwd[a.start] = true;
+        while (!work.empty()) {
+            int u = work.back();
+            work.pop_back();
+            for (int c=EPS; c<a.alphabet.size(); c++) {
+                for (int t: a.next(u,c)) {
+                    if (!fwd[t]) { fwd[t] = true; work.push_back(t); }
+                }
+            }
+        }
+
+        // 反向可达：按终点计数排序出入边
+        vector<int> in(n+1,0), from(es.size());
+        for (auto &e: es) in[e.to+1]++;
+        for (int s=0; s<n; s++) in[s+1] += in[s];
+        vector<int> fill(in.begin(),in.end()-1);
+        for (auto &e: es) from[fill[e.to]++] = e.from;
+        vector<char> bwd(n,false);
+        for (int s=0; s<n; s++) {
+            if (a.accept[s] && fwd[s]) { bwd[s] = true; work.push_back(s); }
+        }
+        while (!work.empty()) {
+            int v = work.back();
+            work.pop_back();
+            for (int i=in[v]; i<in[v+1]; i++) {
+                int u = from[i];
+                if (fwd[u] && !bwd[u]) { bwd[u] = true; work.push_back(u); }
+            }
+        }
+        bwd[a.start] = true;
+
+        vector<int> id(n,-1);
+        vector<char> accept;
+        for (int s=0; s<n; s++) {
+            if (!bwd[s]) continue;
+            id[s] = (int)accept.size();
+            accept.push_back(a.accept[s]);
+        }
+        if ((int)accept.size()==n) return a;
+        vector<FrozenNFA::Edge> kept;
+        for (auto &e: es) {
+            if (id[e.from]>=0 && id[e.to]>=0) kept.push_back({id[e.from],e.symbol,id[e.to]});
+        }
+        return FrozenNFA(a.alphabet,id[a.start],move(accept),kept);
+    }
+};
+
+/**
+ * @brief 在子集构造之前约简无ε转移的NFA
+ *
+ * bisimulation()求最粗的前向互模拟(BisimulationRefiner，初始按是否接受划分)，
+ * 再把每块合并为一个状态。
+ * simulation()求前向模拟预序：q模拟p当且仅当p接受时q也接受，且p的每条转移
+ * p-c->p'都有q-c->q'使q'模拟p'。L(p)⊆L(q)，所以子集中同时出现p和q时可以删去p。
+ * 模拟关系用计数的方法(Henzinger–Henzinger–Kopke)求出，共O(mn)。
+ */
+class NFAReducer {
+public:
+    enum Mode { NONE, BISIMULATION, SIMULATION }; ///< 不约简、互模拟商、互模拟商并按模拟关系删减子集
+    enum { SIMULATION_LIMIT = 1<<24 };            ///< 求模拟关系时关系矩阵与计数器的单元数上限
+
+    /**
+     * @brief 约简方式的名称，即--reduce=的取值
+     */
+    static const char* mode_name(Mode m) {
+        static const char* const names[] = {"none","bisimulation","simulation"};
+        return names[m];
+    }
+
+    /**
+     * @brief 按最粗的前向互模拟合并状态
+     * @param a 无ε转移的NFA
+     * @return 语言相同的商NFA，块按其中最小的状态编号排列
+     */
+    static FrozenNFA bisimulation(const FrozenNFA &a) {
+        int n = a.size();
+        vector<int> initial(n);
+        for (int s=0; s<n; s++) initial[s] = a.accept[s];
+        vector<FrozenNFA::Edge> es = a.edge_list();
+        vector<int> block = BisimulationRefiner::coarsest(n,initial,es);
+        int blocks = n>0?*max_element(block.begin(),block.end())+1:0;
+
+        vector<char> accept(blocks,false);
+        for (int s=0; s<n; s++) accept[block[s]] = a.accept[s];
+        for (auto &e: es) { e.from = block[e.from]; e.to = block[e.to]; }
+        sort(es.begin(),es.end(),[](const FrozenNFA::Edge &x, const FrozenNFA::Edge &y) {
+            return make_tuple(x.from,x.symbol,x.to)<make_tuple(y.from,y.symbol,y.to);
+        });
+        es.erase(unique(es.begin(),es.end(),[](const FrozenNFA::Edge &x, const FrozenNFA::Edge &y) {
+            return x.from==y.from && x.symbol==y.symbol && x.to==y.to;
+        }),es.end());
+        return FrozenNFA(a.alphabet,block[a.start],move(accept),es);
+    }
+
+    /**
+     * @brief 求模拟关系需要的单元数：关系矩阵每对状态一个，计数器每个有转移的(状态, 符号)对每个状态一个
+     */
+    static size_t simulation_cells(const FrozenNFA &a) {
+        size_t pairs = 0;
+        for (int s=0; s<a.size(); s++) {
+            for (int c=0; c<a.alphabet.size(); c++) pairs += !a.next(s,c).empty();
+        }
+        return (size_t)a.size()*(a.size()+pairs);
+    }
+
+    /**
+     * @brief 求模拟关系，列出每个状态在子集中可被哪些状态替代
+     *
+     * sim[p*n+q]表示q模拟p。计数cnt[(q,c),v]为q的c后继中模拟v的个数；
+     * q不再模拟v'时，对每条r-c->q把cnt[(r,c),v']减一，减到0说明r不能
+     * 模拟v'的任何c前驱，r记入remove(v',c)。处理remove(v,c)时，对v的每个
+     * c前驱p，从sim(p)中删去其中的状态。每个状态至多一次进入每个remove(v,c)。
+     * @param a 无ε转移的NFA，simulation_cells(a)不超过SIMULATION_LIMIT
+     * @return larger[p]为严格模拟p的状态，以及与p互相模拟且编号更小的状态
+     */
+    static vector<vector<int>> simulation(const FrozenNFA &a) {
+        int n = a.size(), k = a.alphabet.size();
+        // 有转移的(状态, 符号)对的编号
+        vector<int> pair_of((size_t)n*k,-1);
+        vector<vector<int>> labels(n);
+        int pairs = 0;
+        for (int s=0; s<n; s++) {
+            for (int c=0; c<k; c++) {
+                if (a.next(s,c).empty()) continue;
+                pair_of[(size_t)s*k+c] = pairs++;
+                labels[s].push_back(c);
+            }
+        }
+        // 入边按(终点, 符号)分组，组g的前驱为pred[group_first[g] .. group_first[g+1])
+        vector<FrozenNFA::Edge> es = a.edge_list();
+        sort(es.begin(),es.end(),[](const FrozenNFA::Edge &x, const FrozenNFA::Edge &y) {
+            return make_pair(x.to,x.symbol)<make_pair(y.to,y.symbol);
+        });
+        vector<int> pred(es.size()), group_first, group_to, group_sym, in_first(n+1,0);
+        vector<int> group_of((size_t)n*k,-1);
+        for (size_t i=0; i<es.size(); i++) {
+            if (i==0 || es[i].to!=es[i-1].to || es[i].symbol!=es[i-1].symbol) {
+                group_of[(size_t)es[i].to*k+es[i].symbol] = (int)group_first.size();
+                group_first.push_back((int)i);
+                group_to.push_back(es[i].to);
+                group_sym.push_back(es[i].symbol);
+                in_first[es[i].to+1]++;
+            }
+            pred[i] = es[i].from;
+        }
+        int groups = (int)group_first.size();
+        group_first.push_back((int)es.size());
+        for (int s=0; s<n; s++) in_first[s+1] += in_first[s];
+
+        // 初值：p接受时q也接受，且p有转移的每个符号上q也有转移
+        vector<char> sim((size_t)n*n);
+        for (int p=0; p<n; p++) {
+            for (int q=0; q<n; q++) {
+                bool ok = !a.accept[p] || a.accept[q];
+                for (size_t i=0; ok && i<labels[p].size(); i++) ok = pair_of[(size_t)q*k+labels[p][i]]>=0;
+                sim[(size_t)p*n+q] = ok;
+            }
+        }
+        vector<int> cnt((size_t)pairs*n,0);
+        for (auto &e: es) {
+            int *row = &cnt[(size_t)pair_of[(size_t)e.from*k+e.symbol]*n];
+            for (int v=0; v<n; v++) row[v] += sim[(size_t)v*n+e.to];
+        }
+        vector<vector<int>> remove(groups);
+        vector<int> work;
+        for (int g=0; g<groups; g++) {
+            int v = group_to[g], c = group_sym[g];
+            for (int q=0; q<n; q++) {
+                int o = pair_of[(size_t)q*k+c];
+                if (o>=0 && cnt[(size_t)o*n+v]==0) remove[g].push_back(q);
+            }
+            if (!remove[g].empty()) work.push_back(g);
+        }
+
+        vector<int> rem;
+        while (!work.empty()) {
+            int g = work.back();
+            work.pop_back();
+            rem.clear();
+            rem.swap(remove[g]);
+            for (int i=group_first[g]; i<group_first[g+1]; i++) {
+                int p = pred[i];
+                for (int q: rem) {
+                    if (!sim[(size_t)p*n+q]) continue;
+                    sim[(size_t)p*n+q] = false;
+                    // q不再模拟p：q的各个前驱在相应符号上模拟p的后继少了一个
+                    for (int h=in_first[q]; h<in_first[q+1]; h++) {
+                        int b = group_sym[h], gp = group_of[(size_t)p*k+b];
+                        for (int j=group_first[h]; j<group_first[h+1]; j++) {
+                            int r = pred[j];
+                            if (--cnt[(size_t)pair_of[(size_t)r*k+b]*n+p]==0 && gp>=0) {
+                                remove[gp].push_back(r);
+                                if (remove[gp].size()==1) work.push_back(gp);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        vector<vector<int>> larger(n);
+        for (int p=0; p<n; p++) {
+            for (int q=0; q<n; q++) {
+                if (q!=p && sim[(size_t)p*n+q] && (!sim[(size_t)q*n+p] || q<p)) larger[p].push_back(q);
+            }
+        }
+        return larger;
+    }
+};
+
+//-------------------- NFA -> DFA (子集构造) --------------------
+
+/**
+ * @brief DFA结构定义
+ */
+struct DFA {
+    /**
+     * @brief DFA状态结构
+     */
+    struct State {
+        int id;           ///< 状态编号
+        bool accept;      ///< 是否为接受态
+        vector<int> next; ///< next[c]为输入第c个字节等价类时的转移状态ID
+    };
+    vector<State> states; ///< DFA状态集合
+    int start;            ///< DFA起始状态ID
+    int trap;             ///< 陷阱态ID
+    ByteClasses alphabet; ///< 输入字母表，转移表每个等价类一列
+    DFA():start(-1),trap(-1){}
+};
+
+/**
+ * @brief 利用子集构造法将NFA转换为DFA
+ */
+class SubsetConstruction {
+public:
+    /**
+     * @brief 构造函数
+     * @param n 无ε的NFA
+     */
+    SubsetConstruction(const FrozenNFA &n):infa(n){}
+
+    /**
+     * @brief 每次求转移后从子集中删去可被其中其他状态替代的状态
+     * @param larger larger[p]为可以替代p的状态，见NFAReducer::simulation()
+     */
+    void prune_with(vector<vector<int>> larger) { dominated_by = move(larger); }
+
+    /**
+     * @brief 已生成的非空子集的平均大小
+     */
+    double mean_set_size() const { return set_count?(double)set_elems/set_count:0; }
+
+    /**
+     * @brief 将NFA转换为DFA
+     * @return 生成的DFA
+     */
+    DFA convert() {
+        map<set<int>,int> state_map;
+        vector<set<int>> dfa_sets;
+        auto start_set = set<int>({infa.start});
+        set_elems = set_count = 1;
+
+        queue<set<int>>q;
+        q.push(start_set);
+        state_map[start_set]=0;
+        dfa_sets.push_back(start_set);
+
+        struct TempState{int id;bool acc;vector<int> next;};
+        vector<TempState> tmp;
+        int k = infa.alphabet.size();
+
+        while(!q.empty()) {
+            auto cur = q.front(); q.pop();
+            int cid = state_map[cur];
+
+            bool is_accept = false;
+            for (auto s: cur) {
+                if (infa.accept[s]) { is_accept = true; break; }
+            }
+
+            // 每个字节等价类求一次转移，而不是每个字节
+            vector<int> next(k);
+            for (int c=0; c<k; c++) {
+                next[c] = get_state_id(move_set(cur,c),state_map,dfa_sets,q);
+            }
+
+            tmp.push_back({cid,is_accept,next});
+        }
+
+        if (state_map.find({})==state_map.end()) {
+            int tid = (int)tmp.size();
+            state_map[{}]=tid;
+            dfa_sets.push_back({});
+            tmp.push_back({tid,false,vector<int>(k,tid)});
+        }
+        int trap_id = state_map[{}];
+        for (auto &st: tmp) {
+            for (auto &t: st.next) {
+                if (t<0) t = trap_id;
+            }
+        }
+
+        DFA dfa;
+        dfa.states.resize(tmp.size());
+        for (auto &st: tmp) {
+            dfa.states[st.id].id = st.id;
+            dfa.states[st.id].accept = st.acc;
+            dfa.states[st.id].next = std::move(st.next);
+        }
+        dfa.start = 0;
+        dfa.trap = trap_id;
+        dfa.alphabet = infa.alphabet;
+        return dfa;
+    }
+
+private:
+    const FrozenNFA &infa;            ///< 输入的NFA
+    vector<vector<int>> dominated_by; ///< 为空时不删减子集
+    size_t set_elems = 0;             ///< 已生成的非空子集的大小之和
+    size_t set_count = 0;             ///< 已生成的非空子集数
+
+    /**
+     * @brief 获取集合S对应的DFA状态ID
+     * @param S NFA状态子集
+     * @param m 状态映射表
+     * @param d dfa_sets集合记录
+     * @param q 待处理队列
+     * @return DFA状态ID
+     */
+    int get_state_id(const set<int> &S, map<set<int>,int>&m,vector<set<int>>&d,queue<set<int>>&q) {
+        if (S.empty()) return -1;
+        if (m.find(S)==m.end()) {
+            set_elems += S.size();
+            set_count++;
+            int id = (int)d.size();
+            m[S] = id;
+            d.push_back(S);
+            q.push(S);
+            return id;
+        }
+        return m[S];
+    }
+
+    /**
+     * @brief 从当前NFA状态子集对输入符号c求转移的NFA子集
+     * @param cur 当前NFA状态子集
+     * @param c 输入的字节等价类编号
+     * @return 转移后的NFA状态子集
+     */
+    set<int> move_set(const set<int>&cur,int c) {
+        set<int> res;
+        for (auto s: cur) {
+            for (auto nxt: infa.next(s,c)) {
+                res.insert(nxt);
+            }
+        }
+        if (!dominated_by.empty()) {
+            for (auto it=res.begin(); it!=res.end(); ) {
+                bool covered = false;
+                for (int q: dominated_by[*it]) {
+                    if (res.count(q)) { covered = true; break; }
+                }
+                it = covered?res.erase(it):next(it);
+            }
+        }
+        return res;
+    }
+};
+
+//-------------------- 正则项与导数 --------------------
+
+/**
+ * @brief 哈希合并(hash-consing)的规范化正则项，供基于导数的构造使用
+ *
+ * 结构相同的项只有一个编号，构造时即做规范化：并与交按编号排序、去重并展平(ACI)，
+ * 其中的字节类合并为一个；连接右结合并消去ε与∅；(r*)*=r*，~~r=r，
+ * 可空的r{m,n}下界归零。字节以等价类编号表示。
+ * Unicode码点类没有项的表示，convertible()为假时不能转换。
+ */
+class RegexTerms {
+public:
+    /// 项的种类；SET为字节等价类的集合，OR、AND的items为排序去重的子项
+    enum Kind { EMPTY, EPS_TERM, SET, CAT, STAR, OR, AND, NOT, REPEAT };
+    /// 构造时预先建立的项的编号：∅、ε与~∅(任意字节串)
+    enum { EMPTY_ID = 0, EPS_ID = 1, ALL_ID = 2 };
+
+    /**
+     * @brief 规范化的项
+     */
+    struct Term {
+        Kind kind;
+        int a = -1, b = -1;  ///< CAT的两项，STAR、NOT、REPEAT的子项
+        int lo = 0, hi = 0;  ///< REPEAT的上下界
+        vector<int> items;   ///< SET的等价类编号，或OR、AND的子项，均升序
+        bool nullable = false;
+
+        Term(Kind k, int a=-1, int b=-1) :kind(k),a(a),b(b){}
+
+        bool operator==(const Term &o) const {
+            return kind==o.kind && a==o.a && b==o.b && lo==o.lo && hi==o.hi && items==o.items;
+        }
+    };
+
+    /**
+     * @brief 构造函数，预先建立∅、ε与~∅
+     * @param a 输入字母表
+     */
+    explicit RegexTerms(const ByteClasses &a) :alphabet(a) {
+        make({EMPTY});
+        make({EPS_TERM});
+        make({NOT,EMPTY_ID});
+    }
+
+    /**
+     * @brief 语法树能否转换为项(不含UCLASS节点)
+     */
+    template<class Tree>
+    static bool convertible(const Tree &t) {
+        return !tree_has(t,[](RegexNode::Type x) { return x == RegexNode::UCLASS; });
+    }
+
+    const Term& operator[](int id) const { return terms[id]; } ///< 编号为id的项
+    size_t size() const { return terms.size(); }                ///< 不同项的个数
+
+    /**
+     * @brief 以显式栈后序遍历指针树并转换为项，共享节点只转换一次
+     * @return 根节点对应的项
+     */
+    int convert(RegexNode* root) {
+        unordered_map<RegexNode*,int> done;
+        vector<pair<RegexNode*,bool>> work{{root,false}};
+        while (!work.empty()) {
+            RegexNode* node = work.back().first;
+            bool expanded = work.back().second;
+            work.pop_back();
+            if (done.count(node)) continue;
+            if (!expanded && !node->leaf()) {
+                work.push_back({node,true});
+                if (node->right) work.push_back({node->right,false});
+                work.push_back({node->left,false});
+                continue;
+            }
+            int a = node->left?done[node->left]:-1;
+            int b = node->right?done[node->right]:-1;
+            done[node] = emit(node->type,node->ch,node->text,node->len,a,b);
+        }
+        return done[root];
+    }
+
+    /**
+     * @brief 按后序扫描扁平语法树并转换为项
+     * @return 根节点对应的项
+     */
+    int convert(const FlatRegex &f, FlatRegex::Node root) {
+        vector<int> id(f.size());
+        for (size_t i=0; i<f.size(); i++) {
+            RegexNode::Type t = (RegexNode::Type)f.type[i];
+            if (t == RegexNode::STRING || t == RegexNode::CLASS) {
+                id[i] = emit(t,0,&f.text[f.left[i]],(int)f.right[i],-1,-1);
+            } else if (t == RegexNode::REPEAT) {
+                id[i] = emit(t,0,&f.text[f.right[i]],8,id[f.left[i]],-1);
+            } else {
+                int a = f.left[i]!=FlatRegex::NONE?id[f.left[i]]:-1;
+                int b = f.right[i]!=FlatRegex::NONE?id[f.right[i]]:-1;
+                id[i] = emit(t,f.ch[i],nullptr,0,a,b);
+            }
+        }
+        return id[root];
+    }
+
+    /**
+     * @brief 字节等价类集合，空集为∅
+     */
+    int make_set(vector<int> classes) {
+        if (classes.empty()) return EMPTY_ID;
+        Term t(SET);
+        t.items = move(classes);
+        return make(move(t));
+    }
+
+    /**
+     * @brief 连接a b：消去ε与∅，并按右结合展开a中的连接
+     */
+    int make_cat(int a, int b) {
+        if (a == EMPTY_ID || b == EMPTY_ID) return EMPTY_ID;
+        if (a == EPS_ID) return b;
+        if (b == EPS_ID) return a;
+        vector<int> spine;
+        while (terms[a].kind == CAT) {
+            spine.push_back(terms[a].a);
+            a = terms[a].b;
+        }
+        int res = make(Term(CAT,a,b));
+        for (size_t i=spine.size(); i-->0; ) res = make(Term(CAT,spine[i],res));
+        return res;
+    }
+
+    /**
+     * @brief 闭包：∅*=ε*=ε，(r*)*=r*
+     */
+    int make_star(int a) {
+        if (a == EMPTY_ID || a == EPS_ID) return EPS_ID;
+        if (terms[a].kind == STAR) return a;
+        return make(Term(STAR,a));
+    }
+
+    /**
+     * @brief 补：~~r=r
+     */
+    int make_not(int a) {
+        if (terms[a].kind == NOT) return terms[a].a;
+        return make(Term(NOT,a));
+    }
+
+    /**
+     * @brief 重复a{lo,hi}：a可空时下界归零，化为ε、a或a*等更简单的形式
+     */
+    int make_repeat(int a, int lo, int hi) {
+        if (terms[a].nullable) lo = 0;
+        if (hi == 0 || a == EPS_ID) return EPS_ID;
+        if (a == EMPTY_ID) return lo == 0?EPS_ID:EMPTY_ID;
+        if (lo == 0 && hi == RegexNode::UNBOUNDED) return make_star(a);
+        if (lo == 1 && hi == 1) return a;
+        Term t(REPEAT,a);
+        t.lo = lo;
+        t.hi = hi;
+        return make(move(t));
+    }
+
+    /**
+     * @brief 重复项a{lo,hi}读入一个a之后剩余的部分a{lo-1,hi-1}
+     */
+    int repeat_rest(const Term &t) {
+        return make_repeat(t.a,t.lo>0?t.lo-1:0,t.hi==RegexNode::UNBOUNDED?t.hi:t.hi-1);
+    }
 
     /**
-     * @brief 构建ε-NFA
-     * @return 构建完成的NFA
+     * @brief 并或交(kind为OR或AND)：展平同类子项，合并字节类，排序去重，
+     *        并消去单位元(并的∅、交的~∅)、遇到零元(并的~∅、交的∅)直接返回
      */
-    NFA build() {
-        nfa = NFA();
-        NFAFragment frag = buildFragment(r);
-        nfa.states[frag.accept].accept = true;
-        nfa.start = frag.start;
-        return nfa;
+    int make_assoc(Kind kind, const vector<int> &xs) {
+        int unit = kind==OR?EMPTY_ID:ALL_ID, zero = kind==OR?ALL_ID:EMPTY_ID;
+        vector<int> items;
+        vector<int> set;
+        bool has_set = false;
+        auto add = [&](int x) -> bool {
+            if (x == zero) return false;
+            if (x == unit) return true;
+            if (terms[x].kind == SET) {
+                const vector<int> &s = terms[x].items;
+                vector<int> merged;
+                if (!has_set) merged = s;
+                else if (kind == OR) set_union(set.begin(),set.end(),s.begin(),s.end(),back_inserter(merged));
+                else set_intersection(set.begin(),set.end(),s.begin(),s.end(),back_inserter(merged));
+                set.swap(merged);
+                has_set = true;
+            } else {
+                items.push_back(x);
+            }
+            return true;
+        };
+        for (int x: xs) {
+            if (terms[x].kind == kind) {
+                for (int y: terms[x].items) {
+                    if (!add(y)) return zero;
+                }
+            } else if (!add(x)) {
+                return zero;
+            }
+        }
+        if (has_set) {
+            int s = make_set(set);
+            if (s == zero) return zero;
+            if (s != unit) items.push_back(s);
+        }
+        sort(items.begin(),items.end());
+        items.erase(unique(items.begin(),items.end()),items.end());
+        if (items.empty()) return unit;
+        if (items.size() == 1) return items[0];
+        Term t(kind);
+        t.items = move(items);
+        return make(move(t));
     }
+
 private:
-    RegexNode *r; ///< 正则表达式语法树根节点
-    NFA nfa;       ///< 构造中的NFA
+    struct TermHash {
+        size_t operator()(const Term &t) const {
+            size_t h = (size_t)t.kind;
+            h = h*1000003 ^ (size_t)t.a;
+            h = h*1000003 ^ (size_t)t.b;
+            h = h*1000003 ^ (size_t)t.lo;
+            h = h*1000003 ^ (size_t)t.hi;
+            for (int x: t.items) h = h*131 + (size_t)x;
+            return h;
+        }
+    };
+
+    const ByteClasses &alphabet; ///< 输入字母表
+    vector<Term> terms;          ///< 全部项，下标即编号
+    unordered_map<Term,int,TermHash> table; ///< 项 -> 编号
 
     /**
-     * @brief 添加状态转移
-     * @param from 源状态
-     * @param to 目标状态
-     * @param c 转移字符
+     * @brief 取得项的编号，新项计算可空性后加入表中
      */
-    void add_transition(int from, int to, char c) {
-        nfa.states[from].trans[c].push_back(to);
+    int make(Term t) {
+        auto it = table.find(t);
+        if (it != table.end()) return it->second;
+        switch (t.kind) {
+            case EMPTY: case SET: t.nullable = false; break;
+            case EPS_TERM: case STAR: t.nullable = true; break;
+            case CAT: t.nullable = terms[t.a].nullable && terms[t.b].nullable; break;
+            case NOT: t.nullable = !terms[t.a].nullable; break;
+            case REPEAT: t.nullable = t.lo == 0; break;
+            case OR:
+                t.nullable = false;
+                for (int x: t.items) t.nullable = t.nullable || terms[x].nullable;
+                break;
+            case AND:
+                t.nullable = true;
+                for (int x: t.items) t.nullable = t.nullable && terms[x].nullable;
+                break;
+        }
+        int id = (int)terms.size();
+        terms.push_back(t);
+        table.emplace(move(t),id);
+        return id;
     }
 
     /**
-     * @brief 针对给定正则节点构建NFA片段
-     * @param node 正则节点
-     * @return 对应的NFAFragment
+     * @brief 由节点内容及其子项构造项
+     * @param type 节点类型
+     * @param ch CHAR节点的字符
+     * @param text STRING节点的字面量，CLASS节点的位图，或REPEAT节点的上下界
+     * @param len text的长度
+     * @param a 左子项(STAR、NOT、REPEAT的唯一子项)
+     * @param b 右子项
      */
-    NFAFragment buildFragment(RegexNode* node) {
-        switch(node->type) {
-            case RegexNode::CHAR: {
-                int s = nfa.new_state();
-                int a = nfa.new_state();
-                add_transition(s,a,node->ch);
-                return {s,a};
-            }
-            case RegexNode::CONCAT: {
-                NFAFragment f1 = buildFragment(node->left);
-                NFAFragment f2 = buildFragment(node->right);
-                add_transition(f1.accept,f2.start,EPS);
-                return {f1.start,f2.accept};
-            }
-            case RegexNode::UNION: {
-                int s = nfa.new_state();
-                int a = nfa.new_state();
-                NFAFragment f1 = buildFragment(node->left);
-                NFAFragment f2 = buildFragment(node->right);
-                add_transition(s,f1.start,EPS);
-                add_transition(s,f2.start,EPS);
-                add_transition(f1.accept,a,EPS);
-                add_transition(f2.accept,a,EPS);
-                return {s,a};
+    int emit(RegexNode::Type type, char ch, const char* text, int len, int a, int b) {
+        switch (type) {
+            case RegexNode::CHAR:
+                return make_set({alphabet.of((unsigned char)ch)});
+            case RegexNode::CLASS: {
+                ByteSet set = ByteSet::from_bits(text);
+                vector<int> classes;
+                for (int c=0; c<alphabet.size(); c++) {
+                    if (set.has(alphabet.representative(c))) classes.push_back(c);
+                }
+                return make_set(move(classes));
             }
-            case RegexNode::STAR: {
-                int s = nfa.new_state();
-                int a = nfa.new_state();
-                NFAFragment f = buildFragment(node->left);
-                add_transition(s,f.start,EPS);
-                add_transition(f.accept,a,EPS);
-                add_transition(s,a,EPS);
-                add_transition(f.accept,f.start,EPS);
-                return {s,a};
+            case RegexNode::STRING: {
+                int res = EPS_ID;
+                for (int i=len; i-->0; ) res = make_cat(make_set({alphabet.of((unsigned char)text[i])}),res);
+                return res;
             }
+            case RegexNode::EPSILON: return EPS_ID;
+            case RegexNode::CONCAT: return make_cat(a,b);
+            case RegexNode::UNION: return make_assoc(OR,{a,b});
+            case RegexNode::AND: return make_assoc(AND,{a,b});
+            case RegexNode::NOT: return make_not(a);
+            case RegexNode::STAR: return make_star(a);
+            case RegexNode::REPEAT:
+                return make_repeat(a,RegexNode::decode_bound(text),RegexNode::decode_bound(text+4));
+            default:
+                throw logic_error("unsupported node in regex terms");
         }
-        return {-1,-1};
     }
 };
 
-//-------------------- ε-NFA -> NFA --------------------
-
 /**
- * @brief 将ε-NFA转换为无ε转移的NFA
+ * @brief 用Brzozowski导数直接由语法树构造DFA，不经过NFA与子集构造
+ *
+ * 规范化之后，每个DFA状态就是一个项，项的编号相同即为同一状态；
+ * 对每个字节等价类c求导数：
+ *   d(S)=ε(c∈S时)或∅，d(ab)=d(a)b+(a可空时d(b))，d(a*)=d(a)a*，
+ *   d(a+b)=d(a)+d(b)，d(a&b)=d(a)&d(b)，d(~a)=~d(a)，d(a{m,n})=d(a)a{m-1,n-1}。
+ * 交与补直接按定义求导，不需要乘积构造。
  */
-class EpsilonRemover {
+class DerivativeConstruction {
 public:
     /**
      * @brief 构造函数
-     * @param n 输入的ε-NFA
+     * @param root 正则表达式语法树的根节点
+     * @param a 输入字母表，须已收集该语法树中的所有字节
      */
-    EpsilonRemover(const NFA &n):infa(n){}
+    DerivativeConstruction(RegexNode* root, const ByteClasses &a)
+        :r(root),flat(nullptr),flat_root(FlatRegex::NONE),alphabet(a),terms(a){}
 
     /**
-     * @brief 消除ε转移得到无ε的NFA
-     * @return 无ε转移的NFA
+     * @brief 构造函数
+     * @param f 扁平语法树
+     * @param root 根节点下标
+     * @param a 输入字母表，须已收集该语法树中的所有字节
      */
-    NFA remove() {
-        eps_closures.resize(infa.states.size());
-        for (int i=0; i<(int)infa.states.size(); i++) {
-            compute_epsilon_closure(i);
-        }
+    DerivativeConstruction(const FlatRegex &f, FlatRegex::Node root, const ByteClasses &a)
+        :r(nullptr),flat(&f),flat_root(root),alphabet(a),terms(a){}
 
-        NFA onfa;
-        onfa.states.resize(infa.states.size());
-        for (int i=0; i<(int)infa.states.size(); i++) {
-            onfa.states[i].id = i;
-        }
-        onfa.start = infa.start;
-
-        for (int i=0; i<(int)infa.states.size(); i++) {
-            set<int> closure = eps_closures[i];
-            bool is_accept = false;
-            map<char,set<int>> combined;
-            for (int cst: closure) {
-                if (infa.states[cst].accept) is_accept = true;
-                for (auto &kv: infa.states[cst].trans) {
-                    char c = kv.first;
-                    if (c==EPS) continue;
-                    for (int nxt: kv.second) {
-                        for (int ec: eps_closures[nxt]) {
-                            combined[c].insert(ec);
-                        }
-                    }
+    /**
+     * @brief 构造DFA：从根项出发逐个等价类求导数，新出现的项成为新状态
+     * @return 起始态为0的DFA，含陷阱态(∅)
+     */
+    DFA build() {
+        int root = flat?terms.convert(*flat,flat_root):terms.convert(r);
+        int k = alphabet.size();
+        unordered_map<int,int> state_of; // 项 -> 状态
+        vector<int> order{root};
+        state_of[root] = 0;
+        DFA dfa;
+        for (size_t i=0; i<order.size(); i++) {
+            DFA::State st;
+            st.id = (int)i;
+            st.accept = terms[order[i]].nullable;
+            st.next.resize(k);
+            for (int c=0; c<k; c++) {
+                int d = derive(order[i],c);
+                auto it = state_of.find(d);
+                if (it == state_of.end()) {
+                    it = state_of.emplace(d,(int)order.size()).first;
+                    order.push_back(d);
                 }
+                st.next[c] = it->second;
             }
-            onfa.states[i].accept = is_accept;
-            for (auto &kv: combined) {
-                onfa.states[i].trans[kv.first] = vector<int>(kv.second.begin(),kv.second.end());
-            }
+            dfa.states.push_back(move(st));
         }
-
-        return onfa;
+        int empty = RegexTerms::EMPTY_ID;
+        if (!state_of.count(empty)) {
+            int tid = (int)dfa.states.size();
+            state_of[empty] = tid;
+            dfa.states.push_back({tid,false,vector<int>(k,tid)});
+        }
+        dfa.start = 0;
+        dfa.trap = state_of[empty];
+        dfa.alphabet = alphabet;
+        return dfa;
     }
 
+    /**
+     * @brief 构造过程中生成的不同项的个数
+     */
+    size_t term_count() const { return terms.size(); }
+
 private:
-    const NFA &infa;             ///< 输入的ε-NFA
-    vector<set<int>> eps_closures; ///< 每个状态的ε闭包
-
-    /**
-     * @brief 计算状态s的ε闭包
-     * @param s 状态ID
-     */
-    void compute_epsilon_closure(int s) {
-        if (!eps_closures[s].empty()) return;
-        stack<int> st;
-        st.push(s);
-        eps_closures[s].insert(s);
-        while(!st.empty()) {
-            int u = st.top(); st.pop();
-            auto it = infa.states[u].trans.find(EPS);
-            if (it!=infa.states[u].trans.end()) {
-                for (int nxt: it->second) {
-                    if (eps_closures[s].find(nxt)==eps_closures[s].end()) {
-                        eps_closures[s].insert(nxt);
-                        st.push(nxt);
-                    }
-                }
+    RegexNode *r;                ///< 正则表达式语法树根节点
+    const FlatRegex *flat;       ///< 扁平语法树(为空时使用指针树)
+    FlatRegex::Node flat_root;   ///< 扁平语法树的根节点下标
+    const ByteClasses &alphabet; ///< 输入字母表
+    RegexTerms terms;            ///< 项表
+    vector<vector<int>> memo;    ///< memo[项][等价类]为已求出的导数，-1表示未求
+
+    /**
+     * @brief 项t对等价类c的导数
+     *
+     * 以显式栈按后序求值：所需子项的导数都已记在memo中时才求t的导数，
+     * 否则先把缺少的子项压栈，因此调用栈的深度不随项的嵌套深度增长。
+     */
+    int derive(int t, int c) {
+        typedef RegexTerms T;
+        vector<int> work{t};
+        while (!work.empty()) {
+            int u = work.back();
+            if (cached(u,c) >= 0) { work.pop_back(); continue; }
+            size_t pending = work.size();
+            auto need = [&](int y) { if (cached(y,c) < 0) work.push_back(y); };
+            const T::Term &x = terms[u];
+            switch (x.kind) {
+                case T::CAT:
+                    need(x.a);
+                    if (terms[x.a].nullable) need(x.b);
+                    break;
+                case T::STAR:
+                case T::NOT:
+                case T::REPEAT:
+                    need(x.a);
+                    break;
+                case T::OR:
+                case T::AND:
+                    for (int y: x.items) need(y);
+                    break;
+                default:
+                    break;
             }
+            if (work.size() > pending) continue;
+            work.pop_back();
+            int d = step(u,c);
+            memo[u][c] = d;
         }
+        return memo[t][c];
     }
-};
 
-//-------------------- NFA -> DFA (子集构造) --------------------
+    /**
+     * @brief 已求出的导数，-1表示未求
+     */
+    int cached(int t, int c) {
+        if (memo.size() <= (size_t)t) memo.resize(terms.size());
+        if (memo[t].empty()) memo[t].assign(alphabet.size(),-1);
+        return memo[t][c];
+    }
 
-/**
- * @brief DFA结构定义
- */
-struct DFA {
     /**
-     * @brief DFA状态结构
+     * @brief 在所需子项的导数都已求出时，求项t对等价类c的导数
      */
-    struct State {
-        int id;      ///< 状态编号
-        bool accept; ///< 是否为接受态
-        int t0, t1;  ///< 在输入0或1时的转移状态ID
-    };
-    vector<State> states; ///< DFA状态集合
-    int start;            ///< DFA起始状态ID
-    int trap;             ///< 陷阱态ID
-    DFA():start(-1),trap(-1){}
+    int step(int t, int c) {
+        typedef RegexTerms T;
+        const T::Term x = terms[t]; // 求导会新增项，不能持有引用
+        switch (x.kind) {
+            case T::SET:
+                return binary_search(x.items.begin(),x.items.end(),c)?T::EPS_ID:T::EMPTY_ID;
+            case T::CAT: {
+                int res = terms.make_cat(memo[x.a][c],x.b);
+                if (terms[x.a].nullable) res = terms.make_assoc(T::OR,{res,memo[x.b][c]});
+                return res;
+            }
+            case T::STAR:
+                return terms.make_cat(memo[x.a][c],t);
+            case T::NOT:
+                return terms.make_not(memo[x.a][c]);
+            case T::REPEAT:
+                return terms.make_cat(memo[x.a][c],terms.repeat_rest(x));
+            case T::OR:
+            case T::AND: {
+                vector<int> ds;
+                for (int y: x.items) ds.push_back(memo[y][c]);
+                return terms.make_assoc(x.kind,ds);
+            }
+            default:
+                return T::EMPTY_ID;
+        }
+    }
 };
 
 /**
- * @brief 利用子集构造法将NFA转换为DFA
+ * @brief 用Antimirov偏导数由语法树构造无ε转移的NFA
+ *
+ * 偏导数是项的集合而不是单个项：∂(S)={ε}(c∈S时)，∂(a+b)=∂(a)∪∂(b)，
+ * ∂(ab)=∂(a)b∪(a可空时∂(b))，∂(a*)=∂(a)a*，∂(a{m,n})=∂(a)a{m-1,n-1}。
+ * 每个不同的项是一个NFA状态，状态数不超过字面量位置数加一，
+ * 通常少于Glushkov与Thompson构造；接受态为可空的项。
+ * 并不再合并为一个项，因此交与补没有偏导数表示，supports()为假时应改用Thompson构造。
  */
-class SubsetConstruction {
+class PartialDerivativeConstruction {
 public:
     /**
      * @brief 构造函数
-     * @param n 无ε的NFA
+     * @param root 正则表达式语法树的根节点
+     * @param a 输入字母表，须已收集该语法树中的所有字节
      */
-    SubsetConstruction(const NFA &n):infa(n){}
+    PartialDerivativeConstruction(RegexNode* root, const ByteClasses &a)
+        :r(root),flat(nullptr),flat_root(FlatRegex::NONE),alphabet(a),terms(a){}
 
     /**
-     * @brief 将NFA转换为DFA
-     * @return 生成的DFA
+     * @brief 构造函数
+     * @param f 扁平语法树
+     * @param root 根节点下标
+     * @param a 输入字母表，须已收集该语法树中的所有字节
      */
-    DFA convert() {
-        map<set<int>,int> state_map;
-        vector<set<int>> dfa_sets;
-        auto start_set = set<int>({infa.start});
-
-        queue<set<int>>q;
-        q.push(start_set);
-        state_map[start_set]=0;
-        dfa_sets.push_back(start_set);
-
-        struct TempState{int id;bool acc;int t0;int t1;};
-        vector<TempState> tmp;
+    PartialDerivativeConstruction(const FlatRegex &f, FlatRegex::Node root, const ByteClasses &a)
+        :r(nullptr),flat(&f),flat_root(root),alphabet(a),terms(a){}
 
-        while(!q.empty()) {
-            auto cur = q.front(); q.pop();
-            int cid = state_map[cur];
+    /**
+     * @brief 语法树是否不含AND、NOT与UCLASS节点
+     */
+    template<class Tree>
+    static bool supports(const Tree &t) {
+        return !tree_has(t,[](RegexNode::Type x) {
+            return x == RegexNode::AND || x == RegexNode::NOT || x == RegexNode::UCLASS;
+        });
+    }
 
-            bool is_accept = false;
-            for (auto s: cur) {
-                if (infa.states[s].accept) { is_accept = true; break; }
+    /**
+     * @brief 构造NFA：从根项出发求各等价类的偏导数，新出现的项成为新状态
+     * @return 起始态为0的无ε转移的NFA
+     */
+    NFA build() {
+        int root = flat?terms.convert(*flat,flat_root):terms.convert(r);
+        int k = alphabet.size();
+        NFA nfa;
+        nfa.alphabet = alphabet;
+        unordered_map<int,int> state_of; // 项 -> 状态
+        vector<int> order{root};
+        state_of[root] = nfa.new_state();
+        for (size_t i=0; i<order.size(); i++) {
+            nfa.states[i].accept = terms[order[i]].nullable;
+            for (int c=0; c<k; c++) {
+                vector<int> pd = partial(order[i],c);
+                for (int d: pd) {
+                    auto it = state_of.find(d);
+                    if (it == state_of.end()) {
+                        it = state_of.emplace(d,nfa.new_state()).first;
+                        order.push_back(d);
+                    }
+                    nfa.states[i].trans[c].push_back(it->second);
+                }
             }
+        }
+        nfa.start = 0;
+        return nfa;
+    }
 
-            auto go0 = move_set(cur,'0');
-            auto go1 = move_set(cur,'1');
-
-            int go0_id = get_state_id(go0,state_map,dfa_sets,q);
-            int go1_id = get_state_id(go1,state_map,dfa_sets,q);
+    /**
+     * @brief 构造过程中生成的不同项的个数
+     */
+    size_t term_count() const { return terms.size(); }
 
-            tmp.push_back({cid,is_accept,go0_id,go1_id});
-        }
+private:
+    RegexNode *r;                ///< 正则表达式语法树根节点
+    const FlatRegex *flat;       ///< 扁平语法树(为空时使用指针树)
+    FlatRegex::Node flat_root;   ///< 扁平语法树的根节点下标
+    const ByteClasses &alphabet; ///< 输入字母表
+    RegexTerms terms;            ///< 项表
 
-        if (state_map.find({})==state_map.end()) {
-            int tid = (int)tmp.size();
-            state_map[{}]=tid;
-            dfa_sets.push_back({});
-            tmp.push_back({tid,false,tid,tid});
-        }
-        int trap_id = state_map[{}];
-        for (auto &st: tmp) {
-            if (st.t0<0) st.t0 = trap_id;
-            if (st.t1<0) st.t1 = trap_id;
-        }
+    vector<vector<int>> memo;    ///< memo[项*等价类数+等价类]为已求出的偏导数
+    vector<char> known;          ///< 对应的memo是否已求出
 
-        DFA dfa;
-        dfa.states.resize(tmp.size());
-        for (auto &st: tmp) {
-            dfa.states[st.id].id = st.id;
-            dfa.states[st.id].accept = st.acc;
-            dfa.states[st.id].t0 = st.t0;
-            dfa.states[st.id].t1 = st.t1;
+    /**
+     * @brief 项t对等价类c的偏导数，升序且无重复
+     *
+     * 与DerivativeConstruction::derive()相同，以显式栈按后序求值并记忆结果。
+     */
+    vector<int> partial(int t, int c) {
+        typedef RegexTerms T;
+        vector<int> work{t};
+        while (!work.empty()) {
+            int u = work.back();
+            if (cached(u,c)) { work.pop_back(); continue; }
+            size_t pending = work.size();
+            auto need = [&](int y) { if (!cached(y,c)) work.push_back(y); };
+            const T::Term &x = terms[u];
+            switch (x.kind) {
+                case T::OR:
+                    for (int y: x.items) need(y);
+                    break;
+                case T::CAT:
+                    need(x.a);
+                    if (terms[x.a].nullable) need(x.b);
+                    break;
+                case T::STAR:
+                case T::REPEAT:
+                    need(x.a);
+                    break;
+                default:
+                    break;
+            }
+            if (work.size() > pending) continue;
+            work.pop_back();
+            vector<int> pd = step(u,c);
+            size_t i = (size_t)u*alphabet.size()+c;
+            memo[i] = move(pd);
+            known[i] = true;
         }
-        dfa.start = 0;
-        dfa.trap = trap_id;
-        return dfa;
+        return memo[(size_t)t*alphabet.size()+c];
     }
 
-private:
-    const NFA &infa; ///< 输入的NFA
-
     /**
-     * @brief 获取集合S对应的DFA状态ID
-     * @param S NFA状态子集
-     * @param m 状态映射表
-     * @param d dfa_sets集合记录
-     * @param q 待处理队列
-     * @return DFA状态ID
+     * @brief 项t对等价类c的偏导数是否已求出
      */
-    int get_state_id(const set<int> &S, map<set<int>,int>&m,vector<set<int>>&d,queue<set<int>>&q) {
-        if (S.empty()) return -1;
-        if (m.find(S)==m.end()) {
-            int id = (int)d.size();
-            m[S] = id;
-            d.push_back(S);
-            q.push(S);
-            return id;
-        }
-        return m[S];
+    bool cached(int t, int c) {
+        size_t n = terms.size()*alphabet.size();
+        if (known.size() < n) { known.resize(n,false); memo.resize(n); }
+        return known[(size_t)t*alphabet.size()+c];
     }
 
     /**
-     * @brief 从当前NFA状态子集对输入字符c求转移的NFA子集
-     * @param cur 当前NFA状态子集
-     * @param c 输入字符('0'或'1')
-     * @return 转移后的NFA状态子集
+     * @brief 在所需子项的偏导数都已求出时，求项t对等价类c的偏导数
      */
-    set<int> move_set(const set<int>&cur,char c) {
-        set<int> res;
-        for (auto s: cur) {
-            auto it = infa.states[s].trans.find(c);
-            if (it!=infa.states[s].trans.end()) {
-                for (auto nxt: it->second) {
-                    res.insert(nxt);
+    vector<int> step(int t, int c) {
+        typedef RegexTerms T;
+        const T::Term x = terms[t]; // 求偏导数会新增项，不能持有引用
+        int k = alphabet.size();
+        vector<int> out;
+        switch (x.kind) {
+            case T::SET:
+                if (binary_search(x.items.begin(),x.items.end(),c)) out.push_back(T::EPS_ID);
+                return out;
+            case T::OR:
+                for (int y: x.items) {
+                    const vector<int> &d = memo[(size_t)y*k+c];
+                    out.insert(out.end(),d.begin(),d.end());
+                }
+                break;
+            case T::CAT:
+            case T::STAR:
+            case T::REPEAT: {
+                int rest = x.kind==T::CAT?x.b:(x.kind==T::STAR?t:terms.repeat_rest(x));
+                for (int y: memo[(size_t)x.a*k+c]) out.push_back(terms.make_cat(y,rest));
+                if (x.kind == T::CAT && terms[x.a].nullable) {
+                    const vector<int> &e = memo[(size_t)x.b*k+c];
+                    out.insert(out.end(),e.begin(),e.end());
                 }
+                break;
             }
+            default:
+                return out;
         }
-        return res;
+        sort(out.begin(),out.end());
+        out.erase(unique(out.begin(),out.end()),out.end());
+        return out;
     }
 };
 
@@ -481,11 +4534,12 @@ public:
         bool changed = true;
         while(changed) {
             changed = false;
-            map<array<int,3>,vector<int>> groups;
+            // 键为(所在类, 各等价类输入下目标所在类)
+            map<vector<int>,vector<int>> groups;
+            vector<int> key;
             for (int i=0; i<(int)idfa.states.size(); i++) {
-                int c0 = partition[idfa.states[i].t0];
-                int c1 = partition[idfa.states[i].t1];
-                array<int,3> key = {partition[i],c0,c1};
+                key.assign(1,partition[i]);
+                for (int t: idfa.states[i].next) key.push_back(partition[t]);
                 groups[key].push_back(i);
             }
 
@@ -495,49 +4549,267 @@ public:
                 for (auto s: g.second) {
                     new_partition[s] = new_class;
                 }
-                new_class++;
-            }
-            if (new_partition != partition) {
-                partition = new_partition;
-                changed = true;
+                new_class++;
+            }
+            if (new_partition != partition) {
+                partition = new_partition;
+                changed = true;
+            }
+        }
+
+        int count_classes = *max_element(partition.begin(), partition.end())+1;
+        vector<int> repr(count_classes,-1);
+        for (int i=0; i<(int)partition.size(); i++) {
+            if (repr[partition[i]]<0) repr[partition[i]]=i;
+        }
+
+        DFA md;
+        md.states.resize(count_classes);
+        int start_class = partition[idfa.start];
+        md.start = start_class;
+        int trap_class = partition[idfa.trap];
+
+        // 确定每个类的接受态属性
+        for (int c=0; c<count_classes; c++) {
+            int s = repr[c];
+            bool class_accept = false;
+            for (int i=0; i<(int)idfa.states.size(); i++) {
+                if (partition[i] == c && idfa.states[i].accept) {
+                    class_accept = true;
+                    break;
+                }
+            }
+
+            md.states[c].id = c;
+            md.states[c].accept = class_accept;
+            for (int t: idfa.states[s].next) md.states[c].next.push_back(partition[t]);
+        }
+        md.trap = trap_class;
+        md.alphabet = idfa.alphabet;
+        return md;
+    }
+private:
+    const DFA &idfa; ///< 输入的未最小化DFA
+};
+
+//-------------------- 交与补 --------------------
+
+/**
+ * @brief 交与补的自动机构造
+ *
+ * 默认按需(惰性)构造：交运算从两个ε-NFA的起始态对出发做乘积，ε转移在任一侧
+ * 单独进行、字节等价类上的转移两侧同步进行，只生成可达的状态对，两侧都接受时接受；
+ * 补运算在ε-NFA上按需做子集构造，空集即陷阱态(对每个等价类自环)，
+ * 把接受与否取反后，原来落入陷阱态的串也被接受。
+ *
+ * 物化模式先把两侧分别转换为完整的最小DFA，再对全部状态对构造乘积，
+ * 用于与惰性构造比较。
+ */
+class ProductConstruction {
+public:
+    /**
+     * @brief 构造函数
+     * @param materialize 是否使用物化的完整乘积
+     */
+    explicit ProductConstruction(bool materialize):eager(materialize){}
+
+    /**
+     * @brief 交：L(a)∩L(b)
+     * @param a 左侧ε-NFA
+     * @param b 右侧ε-NFA，字母表与a相同
+     * @return 乘积自动机(可有多个接受态)
+     */
+    NFA intersect(const NFA &a, const NFA &b) {
+        if (eager) return from_dfa(product(to_dfa(a),to_dfa(b)));
+        NFA res;
+        res.alphabet = a.alphabet;
+        map<pair<int,int>,int> id;   // 状态对 -> 乘积状态
+        vector<pair<int,int>> pairs; // 按编号排列的状态对，兼作BFS队列
+        auto get = [&](int p, int q) {
+            auto it = id.find({p,q});
+            if (it != id.end()) return it->second;
+            int n = res.new_state(a.states[p].accept && b.states[q].accept);
+            id[{p,q}] = n;
+            pairs.push_back({p,q});
+            return n;
+        };
+        res.start = get(a.start,b.start);
+        for (size_t k=0; k<pairs.size(); k++) {
+            int p = pairs[k].first, q = pairs[k].second;
+            const auto &tp = a.states[p].trans;
+            const auto &tq = b.states[q].trans;
+            for (auto &kv: tp) {
+                if (kv.first == EPS) {
+                    for (int t: kv.second) {
+                        int to = get(t,q);
+                        res.states[k].trans[EPS].push_back(to);
+                    }
+                    continue;
+                }
+                auto it = tq.find(kv.first);
+                if (it == tq.end()) continue;
+                for (int t1: kv.second) {
+                    for (int t2: it->second) {
+                        int to = get(t1,t2);
+                        res.states[k].trans[kv.first].push_back(to);
+                    }
+                }
+            }
+            auto eq = tq.find(EPS);
+            if (eq != tq.end()) {
+                for (int t: eq->second) {
+                    int to = get(p,t);
+                    res.states[k].trans[EPS].push_back(to);
+                }
+            }
+        }
+        return res;
+    }
+
+    /**
+     * @brief 补：Σ*\L(a)，Σ为a的字母表中的全部字节
+     * @param a ε-NFA
+     * @return 确定的补自动机(无ε转移，含陷阱态)
+     */
+    NFA complement(const NFA &a) {
+        if (eager) {
+            DFA d = to_dfa(a);
+            for (auto &st: d.states) st.accept = !st.accept;
+            return from_dfa(d);
+        }
+        FrozenNFA f(a);
+        closures.assign(f.size(),vector<int>());
+        NFA res;
+        res.alphabet = a.alphabet;
+        int k = a.alphabet.size();
+        map<vector<int>,int> id; // ε闭合的状态子集 -> 补自动机状态
+        vector<vector<int>> sets;
+        auto get = [&](vector<int> &S) {
+            auto it = id.find(S);
+            if (it != id.end()) return it->second;
+            bool acc = false;
+            for (int s: S) acc = acc || f.accept[s];
+            int n = res.new_state(!acc);
+            id[S] = n;
+            sets.push_back(S);
+            return n;
+        };
+        vector<int> S = closure(f,{f.start});
+        res.start = get(S);
+        for (size_t cur=0; cur<sets.size(); cur++) {
+            for (int c=0; c<k; c++) {
+                vector<int> moved;
+                for (int s: sets[cur]) {
+                    FrozenNFA::Targets ts = f.next(s,c);
+                    moved.insert(moved.end(),ts.begin(),ts.end());
+                }
+                vector<int> T = closure(f,moved);
+                int to = get(T);
+                res.states[cur].trans[c].push_back(to);
             }
         }
+        return res;
+    }
 
-        int count_classes = *max_element(partition.begin(), partition.end())+1;
-        vector<int> repr(count_classes,-1);
-        for (int i=0; i<(int)partition.size(); i++) {
-            if (repr[partition[i]]<0) repr[partition[i]]=i;
+private:
+    bool eager;                    ///< 是否物化
+    vector<vector<int>> closures;  ///< 已计算的单个状态的ε闭包(按需计算)
+
+    /**
+     * @brief 状态集合的ε闭包，升序排列
+     */
+    vector<int> closure(const FrozenNFA &a, const vector<int> &from) {
+        vector<int> res;
+        for (int s: from) {
+            if (closures[s].empty()) {
+                vector<int> &c = closures[s];
+                vector<bool> seen(a.size(),false);
+                vector<int> st(1,s);
+                seen[s] = true;
+                while (!st.empty()) {
+                    int u = st.back(); st.pop_back();
+                    c.push_back(u);
+                    for (int t: a.next(u,EPS)) {
+                        if (!seen[t]) { seen[t] = true; st.push_back(t); }
+                    }
+                }
+            }
+            res.insert(res.end(),closures[s].begin(),closures[s].end());
         }
+        sort(res.begin(),res.end());
+        res.erase(unique(res.begin(),res.end()),res.end());
+        return res;
+    }
 
-        DFA md;
-        md.states.resize(count_classes);
-        int start_class = partition[idfa.start];
-        md.start = start_class;
-        int trap_class = partition[idfa.trap];
+    /**
+     * @brief 把ε-NFA物化为完整的最小DFA
+     */
+    static DFA to_dfa(const NFA &a) {
+        FrozenNFA f(a);
+        EpsilonRemover er(f);
+        FrozenNFA n = er.remove();
+        SubsetConstruction sc(n);
+        DFA d = sc.convert();
+        DFAMinimizer dm(d);
+        return dm.minimize();
+    }
 
-        // 确定每个类的接受态属性
-        for (int c=0; c<count_classes; c++) {
-            int s = repr[c];
-            bool class_accept = false;
-            for (int i=0; i<(int)idfa.states.size(); i++) {
-                if (partition[i] == c && idfa.states[i].accept) {
-                    class_accept = true;
-                    break;
+    /**
+     * @brief 两个完整DFA的全部状态对的乘积
+     */
+    static DFA product(const DFA &x, const DFA &y) {
+        DFA d;
+        int ny = (int)y.states.size();
+        d.alphabet = x.alphabet;
+        d.states.resize(x.states.size()*y.states.size());
+        for (int i=0; i<(int)x.states.size(); i++) {
+            for (int j=0; j<ny; j++) {
+                DFA::State &st = d.states[i*ny+j];
+                st.id = i*ny+j;
+                st.accept = x.states[i].accept && y.states[j].accept;
+                for (size_t c=0; c<x.states[i].next.size(); c++) {
+                    st.next.push_back(x.states[i].next[c]*ny+y.states[j].next[c]);
                 }
             }
+        }
+        d.start = x.start*ny+y.start;
+        d.trap = x.trap*ny+y.trap;
+        return d;
+    }
 
-            md.states[c].id = c;
-            md.states[c].accept = class_accept;
-            md.states[c].t0 = partition[idfa.states[s].t0];
-            md.states[c].t1 = partition[idfa.states[s].t1];
+    /**
+     * @brief 把DFA视为无ε转移的NFA
+     */
+    static NFA from_dfa(const DFA &d) {
+        NFA n;
+        n.alphabet = d.alphabet;
+        for (auto &st: d.states) {
+            int id = n.new_state(st.accept);
+            for (size_t c=0; c<st.next.size(); c++) n.states[id].trans[(int)c].push_back(st.next[c]);
         }
-        md.trap = trap_class;
-        return md;
+        n.start = d.start;
+        return n;
     }
-private:
-    const DFA &idfa; ///< 输入的未最小化DFA
 };
 
+NFAFragment Thompson::boolean(RegexNode::Type type, NFAFragment f1, NFAFragment f2, int lo) {
+    Clock::time_point t = Clock::now();
+    int hi = (int)nfa.states.size();
+    ProductConstruction pc(materialize);
+    NFA res = type==RegexNode::AND?pc.intersect(extract(lo,hi,f1),extract(lo,hi,f2))
+                                  :pc.complement(extract(lo,hi,f1));
+    // 子片段不再需要：删去其状态区间，以及复用模式下记录在该区间内的片段
+    nfa.states.resize(lo);
+    for (auto it=built.begin(); it!=built.end(); ) {
+        if (it->second.hi > lo) it = built.erase(it);
+        else ++it;
+    }
+    product_states_ += (long long)res.states.size();
+    NFAFragment f = embed(res);
+    product_ms_ += elapsed_ms(t);
+    return f;
+}
+
 //-------------------- 输出最小化DFA和RG --------------------
 
 /**
@@ -555,7 +4827,10 @@ public:
      * @brief 输出最小化DFA和对应的RG文法
      */
     void print_and_convert_to_RG() {
-        cout << "      0 1\n";
+        const ByteClasses &ab = idfa.alphabet;
+        cout << "      ";
+        for (int c=0; c<ab.size(); c++) cout << (c?" ":"") << ab.label(c);
+        cout << "\n";
         vector<string> qname = name_states();
 
         // 输出最小化DFA
@@ -564,30 +4839,32 @@ public:
             int i = pr.second;
             bool start_mark = (i==idfa.start);
             bool accept_mark = idfa.states[i].accept;
-            cout << (start_mark?"(s)":"") << (accept_mark?"(e)":"") << qname[i] << " "
-                 << qname[idfa.states[i].t0] << " " << qname[idfa.states[i].t1] << "\n";
+            cout << (start_mark?"(s)":"") << (accept_mark?"(e)":"") << qname[i];
+            for (int t: idfa.states[i].next) cout << " " << qname[t];
+            cout << "\n";
         }
 
         cout << "\n";
 
         // 输出RG: 按q0,q1,q2...顺序输出产生式
-        // 对于每个状态qX：
+        // 对于每个状态qX，按等价类顺序(二进制时即0、1)：
         //   qX->0qY
         //   qX->1qZ
         //   qX->0
         //   qX->1
+        // 多字节的等价类以其名称[...]作为终结符，表示其中任一字节
         for (auto &p: order) {
             int stid = p.second;
             string lhs = qname[stid];
+            const vector<int> &next = idfa.states[stid].next;
 
-            int t0 = idfa.states[stid].t0;
-            int t1 = idfa.states[stid].t1;
-
-            cout << lhs << "->0" << qname[t0] << "\n";
-            cout << lhs << "->1" << qname[t1] << "\n";
-            //如果输入0或1后到达终结态，输出 例如q0->0或q0->1
-            if (idfa.states[t0].accept) cout << lhs << "->0\n";
-            if (idfa.states[t1].accept) cout << lhs << "->1\n";
+            for (int c=0; c<(int)next.size(); c++) {
+                cout << lhs << "->" << ab.label(c) << qname[next[c]] << "\n";
+            }
+            //如果输入某个符号后到达终结态，输出 例如q0->0或q0->1
+            for (int c=0; c<(int)next.size(); c++) {
+                if (idfa.states[next[c]].accept) cout << lhs << "->" << ab.label(c) << "\n";
+            }
         }
     }
 
@@ -608,9 +4885,7 @@ private:
         int qid_count = 1;
         while(!Q.empty()) {
             int u = Q.front(); Q.pop();
-            int nxts[2] = {idfa.states[u].t0, idfa.states[u].t1};
-            for (int i=0;i<2;i++){
-                int v = nxts[i];
+            for (int v: idfa.states[u].next) {
                 if (!visited[v]) {
                     visited[v]=true;
                     qname[v]="q"+to_string(qid_count++);
@@ -645,41 +4920,792 @@ private:
     }
 };
 
-//-------------------- main --------------------
+//-------------------- 输入预检 --------------------
 
 /**
- * @brief 主函数，执行正则表达式->最小化DFA->RG转换的完整流程
+ * @brief 正则表达式输入的预检：在解析之前一次扫描完成字符集检查、括号配对检查，
+ *        并统计括号嵌套深度和各类符号数量，用于预估语法树与NFA的规模
+ *
+ * 输入可以分多段送入scan()。有SSE2/AVX2时每次处理16/32字节：先用字节比较
+ * 得到各类符号的位掩码，再用popcount计数；块内只有'('或只有')'时嵌套深度
+ * 单调变化，可以整块更新，两者都出现时该块退回逐字节处理。
+ * 转义、字符类、重复次数和控制字节都很少见，含有 [ ] { } \ 或控制字节的块，
+ * 以及它们跨越块边界时，同样退回逐字节处理。
  */
-int main() {
-    ios::sync_with_stdio(false);
-    cin.tie(nullptr);
+class RegexScanner {
+public:
+    RegexScanner() { reset(); }
+
+    /**
+     * @brief 清空统计，准备扫描新的正则表达式
+     */
+    void reset() {
+        offset = 0;
+        depth = 0;
+        max_depth_ = 0;
+        mode = NORMAL;
+        hex_left = 0;
+        literals = unions = stars = groups = 0;
+    }
+
+    /**
+     * @brief 扫描下一段输入
+     * @param data 片段起始地址
+     * @param n 片段长度
+     * @throw RegexError 出现非法字符或多余的')'
+     */
+    void scan(const char* data, size_t n) {
+        size_t i = 0;
+#if defined(__AVX2__)
+        for (; i+32<=n; i+=32) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data+i));
+            // [ ] { } \ 以及小于0x20的控制字节(无符号比较：max(v,0x1f)==0x1f)；
+            // '['、']'(0x5b、0x5d)与'{'、'}'(0x7b、0x7d)只差0x20位，置位后一并比较
+            __m256i folded = _mm256_or_si256(v,_mm256_set1_epi8(0x20));
+            uint32_t special = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(
+                _mm256_cmpeq_epi8(folded,_mm256_set1_epi8('{')),_mm256_cmpeq_epi8(folded,_mm256_set1_epi8('}'))),
+                _mm256_or_si256(_mm256_cmpeq_epi8(v,_mm256_set1_epi8('\\')),
+                _mm256_cmpeq_epi8(_mm256_max_epu8(v,_mm256_set1_epi8(0x1f)),_mm256_set1_epi8(0x1f)))));
+            uint32_t uni = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v,_mm256_set1_epi8('+')));
+            uint32_t star = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v,_mm256_set1_epi8('*')));
+            uint32_t open = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v,_mm256_set1_epi8('(')));
+            uint32_t close = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v,_mm256_set1_epi8(')')));
+            if (!block(32,0xffffffffu,special,uni,star,open,close)) scalar(data+i,32);
+        }
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+        for (; i+16<=n; i+=16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data+i));
+            __m128i folded = _mm_or_si128(v,_mm_set1_epi8(0x20));
+            uint32_t special = (uint32_t)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(
+                _mm_cmpeq_epi8(folded,_mm_set1_epi8('{')),_mm_cmpeq_epi8(folded,_mm_set1_epi8('}'))),
+                _mm_or_si128(_mm_cmpeq_epi8(v,_mm_set1_epi8('\\')),
+                _mm_cmpeq_epi8(_mm_max_epu8(v,_mm_set1_epi8(0x1f)),_mm_set1_epi8(0x1f)))));
+            uint32_t uni = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v,_mm_set1_epi8('+')));
+            uint32_t star = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v,_mm_set1_epi8('*')));
+            uint32_t open = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v,_mm_set1_epi8('(')));
+            uint32_t close = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v,_mm_set1_epi8(')')));
+            if (!block(16,0xffffu,special,uni,star,open,close)) scalar(data+i,16);
+        }
+#endif
+        scalar(data+i,n-i);
+    }
+
+    /**
+     * @brief 输入结束，检查括号是否全部闭合
+     * @throw RegexError 有未闭合的'('
+     */
+    void finish() const {
+        if (depth != 0) throw RegexError("unmatched '('",offset);
+    }
+
+    size_t max_depth() const { return max_depth_; } ///< 括号最大嵌套深度
+
+    /**
+     * @brief 语法树节点数的上界：每个字面量(转义序列、字符类各算一个)、
+     *        运算符各一个节点，再加上相邻运算单元之间隐式的连接节点
+     */
+    size_t estimated_nodes() const { return 2*literals+unions+stars+groups; }
+
+    /**
+     * @brief Thompson构造的状态数上界：每个字面量、'+'、'*'至多引入两个状态
+     */
+    size_t estimated_states() const { return 2*(literals+unions+stars)+2; }
+
+private:
+    size_t offset;     ///< 已扫描的字符数
+    size_t depth;      ///< 当前括号嵌套深度
+    size_t max_depth_; ///< 最大嵌套深度
+    size_t literals, unions, stars, groups; ///< 各类符号的数量
+
+    /// 逐字节处理时的词法状态：普通、转义、"\\x"之后、字符类内部、字符类内的转义、重复次数
+    enum Mode { NORMAL, ESCAPE, HEX, CLASS, CLASS_ESCAPE, CLASS_HEX, REPEAT };
+    Mode mode;    ///< 当前词法状态，可跨越片段和块的边界
+    int hex_left; ///< HEX状态下尚余的十六进制位数
+
+    /**
+     * @brief 位掩码中1的个数
+     */
+    static int popcount(uint32_t x) {
+#if defined(__GNUC__)
+        return __builtin_popcount(x);
+#else
+        int c = 0;
+        for (; x; x &= x-1) c++;
+        return c;
+#endif
+    }
+
+    /**
+     * @brief 用位掩码整块处理w个字节，除special和运算符外的字节都是字面量
+     * @return 能否整块处理；处于转义或字符类之中、出现special字节或'('与')'混杂时
+     *         返回false，由调用者逐字节处理
+     */
+    bool block(size_t w, uint32_t full, uint32_t special, uint32_t uni,
+               uint32_t star, uint32_t open, uint32_t close) {
+        if (mode != NORMAL || special) return false;
+        if (open && close) return false;
+        uint32_t lit = full&~(uni|star|open|close);
+        size_t o = (size_t)popcount(open), c = (size_t)popcount(close);
+        if (c > depth) return false;
+        depth = depth+o-c;
+        max_depth_ = max(max_depth_,depth);
+        literals += (size_t)popcount(lit);
+        unions += (size_t)popcount(uni);
+        stars += (size_t)popcount(star);
+        groups += o;
+        offset += w;
+        return true;
+    }
+
+    /**
+     * @brief 逐字节处理
+     */
+    void scalar(const char* p, size_t n) {
+        for (size_t i=0; i<n; i++, offset++) {
+            unsigned char c = (unsigned char)p[i];
+            if (c < 0x20) throw RegexError("unexpected control character",offset);
+            if (mode != NORMAL) {
+                // 转义与字符类的细节由解析器检查，这里只需找到其结尾
+                switch (mode) {
+                    case ESCAPE:
+                    case CLASS_ESCAPE:
+                        if (c == 'x') {
+                            mode = mode==ESCAPE?HEX:CLASS_HEX;
+                            hex_left = 2;
+                        } else {
+                            mode = mode==ESCAPE?NORMAL:CLASS;
+                        }
+                        break;
+                    case HEX:
+                    case CLASS_HEX:
+                        if (--hex_left == 0) mode = mode==HEX?NORMAL:CLASS;
+                        break;
+                    case REPEAT:
+                        if (c == '}') mode = NORMAL;
+                        break;
+                    default: // CLASS
+                        if (c == '\\') mode = CLASS_ESCAPE;
+                        else if (c == ']') mode = NORMAL;
+                        break;
+                }
+                continue;
+            }
+            switch (p[i]) {
+                case '\\': literals++; mode = ESCAPE; break;
+                case '[': literals++; mode = CLASS; break;
+                case ']': throw RegexError("unmatched ']'",offset);
+                case '{': mode = REPEAT; break;
+                case '}': throw RegexError("unmatched '}'",offset);
+                case '+': unions++; break;
+                case '*': stars++; break;
+                case '(':
+                    groups++;
+                    max_depth_ = max(max_depth_,++depth);
+                    break;
+                case ')':
+                    if (depth == 0) throw RegexError("unmatched ')'",offset);
+                    depth--;
+                    break;
+                default: literals++; break;
+            }
+        }
+    }
+};
+
+//-------------------- 输入 --------------------
+
+/**
+ * @brief 只读内存映射文件；不支持mmap的平台上退化为一次性读入
+ */
+class MappedFile {
+public:
+    /**
+     * @brief 构造函数，映射整个文件
+     * @param path 文件路径
+     */
+    explicit MappedFile(const string &path):ptr(nullptr),len(0),mapped(false),opened(false) {
+#if defined(__unix__) || defined(__APPLE__)
+        int fd = open(path.c_str(),O_RDONLY);
+        if (fd < 0) return;
+        opened = true;
+        struct stat st;
+        if (fstat(fd,&st) == 0 && st.st_size > 0) {
+            void* m = mmap(nullptr,(size_t)st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+            if (m != MAP_FAILED) {
+                ptr = static_cast<const char*>(m);
+                len = (size_t)st.st_size;
+                mapped = true;
+            }
+        }
+        close(fd);
+        if (mapped) return;
+#endif
+        ifstream fin(path,ios::binary);
+        if (!fin) return;
+        opened = true;
+        fallback.assign(istreambuf_iterator<char>(fin),istreambuf_iterator<char>());
+        ptr = fallback.data();
+        len = fallback.size();
+    }
+
+    ~MappedFile() {
+#if defined(__unix__) || defined(__APPLE__)
+        if (mapped) munmap(const_cast<char*>(ptr),len);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /**
+     * @brief 是否成功打开
+     */
+    bool ok() const { return opened; }
+
+    const char* data() const { return ptr; } ///< 文件内容
+    size_t size() const { return len; }      ///< 文件长度
+
+private:
+    const char* ptr;      ///< 映射(或读入)的内容
+    size_t len;           ///< 内容长度
+    bool mapped;          ///< 是否为mmap映射
+    bool opened;          ///< 是否成功打开
+    vector<char> fallback; ///< 无法映射时读入的内容
+};
+
+/**
+ * @brief 正则表达式输入：内存中的一段文本(如映射的文件、批处理的一行)或分块读取的流
+ *
+ * 两种来源都只以片段形式送入解析器，不会先拼成一个完整的字符串。
+ * 与 cin >> re 相同，跳过开头的空白并在下一个空白处结束。
+ */
+class RegexInput {
+public:
+    /**
+     * @brief 来自内存的输入，不复制
+     */
+    static RegexInput from_memory(const char* data, size_t n) {
+        RegexInput in;
+        in.data = data;
+        in.len = n;
+        return in;
+    }
+
+    /**
+     * @brief 内存输入在解析后仍然有效，语法树可以直接引用其中的字面量；流输入返回空指针
+     */
+    const char* memory() const { return data; }
+    size_t memory_size() const { return len; } ///< 内存输入的长度
+
+    /**
+     * @brief 来自流的输入，每次读取已经到达的内容
+     */
+    static RegexInput from_stream(istream &is) {
+        RegexInput in;
+        in.stream = &is;
+        return in;
+    }
+
+    /**
+     * @brief 把输入逐块预检后送入解析器，并完成解析
+     *
+     * 每一块先由scanner检查并计数，再按计数预留语法树空间，最后交给解析器。
+     * @param parser BasicRegexParser实例
+     * @param scanner 预检器，结束后保存整个输入的统计
+     * @return 语法树的根节点
+     * @throw RegexError 输入不合法
+     */
+    template<class Parser>
+    typename Parser::Node parse_with(Parser &parser, RegexScanner &scanner) const {
+        parser.reset();
+        scanner.reset();
+        if (!stream) {
+            const char* b = data;
+            const char* e = data+len;
+            while (b != e && isspace((unsigned char)*b)) b++;
+            feed_token(parser,scanner,b,e);
+            scanner.finish();
+            return parser.finish();
+        }
+        vector<char> buf(CHUNK);
+        bool started = false;
+        while (size_t n = read_available(buf.data(),buf.size())) {
+            const char* b = buf.data();
+            const char* e = b+n;
+            if (!started) {
+                while (b != e && isspace((unsigned char)*b)) b++;
+                if (b == e) continue;
+                started = true;
+            }
+            if (feed_token(parser,scanner,b,e)) break;
+        }
+        scanner.finish();
+        return parser.finish();
+    }
+
+private:
+    static const size_t CHUNK = 1<<16; ///< 流的分块大小
+
+    const char* data = nullptr;  ///< 内存输入
+    size_t len = 0;              ///< 内存输入长度
+    istream* stream = nullptr;   ///< 流输入
+
+    /**
+     * @brief 从流中读取已经到达的内容，至多n字节
+     *
+     * 没有可读的内容时只等到下一批数据到达，而不是等满一整块或输入结束，
+     * 所以交互输入的正则表达式在回车后即被处理。
+     * @return 读取的字节数，0表示输入结束
+     */
+    size_t read_available(char* buf, size_t n) const {
+        streambuf* sb = stream->rdbuf();
+        if (sb->sgetc() == char_traits<char>::eof()) return 0;
+        streamsize avail = max(sb->in_avail(),(streamsize)1);
+        return (size_t)sb->sgetn(buf,min(avail,(streamsize)n));
+    }
+
+    /**
+     * @brief 送入[b,e)中第一个空白之前的部分
+     * @return 是否遇到了结束记号的空白
+     */
+    template<class Parser>
+    static bool feed_token(Parser &parser, RegexScanner &scanner, const char* b, const char* e) {
+        const char* ws = find_if(b,e,[](char c){ return isspace((unsigned char)c)!=0; });
+        size_t before = scanner.estimated_nodes();
+        scanner.scan(b,(size_t)(ws-b));
+        parser.reserve(scanner.estimated_nodes()-before,scanner.max_depth());
+        parser.feed(b,(size_t)(ws-b));
+        return ws != e;
+    }
+};
+
+//-------------------- 流程与命令行 --------------------
 
-    string re;
-    cin >> re;
+/**
+ * @brief 命令行选项
+ */
+struct Options {
+    bool intern = false;   ///< --intern: 结构相同的子表达式共享同一节点
+    bool simplify = false; ///< --simplify: Thompson构造前化简语法树
+    bool factor = false;   ///< --factor: 提取并运算分支的公共前缀/后缀
+    bool flat = false;     ///< --flat: 解析为扁平语法树并直接交给Thompson构造
+    bool stats = false;    ///< --stats: 向标准错误输出各阶段统计
+    bool materialize = false; ///< --materialize: 交与补先物化两侧的最小DFA再构造完整乘积
+    /// 自动机的构造方法：Thompson、收缩ε链的Thompson、Glushkov、follow自动机、Antimirov偏导数、Brzozowski导数
+    enum Construction { THOMPSON, COMPACT, GLUSHKOV, FOLLOW, ANTIMIROV, DERIVATIVE };
+    Construction construction = THOMPSON; ///< --construction=方法名: 自动机的构造方法
+    NFARenumberer::Order renumber = NFARenumberer::CREATION; ///< --renumber=bfs|dfs: 构造后按遍历顺序重新编号NFA状态
+    NFAReducer::Mode reduce = NFAReducer::NONE; ///< --reduce=bisimulation|simulation: 子集构造前约简NFA
+    bool batch = false;    ///< --batch [文件]: 每行一个正则表达式，逐个处理
+    string input_file;     ///< --file 文件: 从内存映射的文件读入正则表达式
+    string batch_file;     ///< 批处理输入文件，为空时读标准输入
+
+    /**
+     * @brief 构造方法的名称，即--construction=的取值
+     */
+    static const char* construction_name(Construction c) {
+        static const char* const names[] = {"thompson","compact","glushkov","follow","antimirov","derivative"};
+        return names[c];
+    }
+};
+
+/**
+ * @brief 在多个正则表达式之间复用的缓冲区
+ */
+struct Workspace {
+    RegexNodePool pool;   ///< 指针语法树节点池
+    FlatRegex flat;       ///< 扁平语法树
+    RegexScanner scanner; ///< 输入预检器
+};
+
+/**
+ * @brief 对已生成的语法树执行 ε-NFA -> NFA -> DFA -> 最小化DFA -> RG 的流程
+ * @param root 指针语法树的根(opt.flat时不使用)
+ * @param flat_root 扁平语法树的根(仅opt.flat时使用)
+ * @param estimated_states 预计的ε-NFA状态数
+ * @param opt 命令行选项
+ * @param ws 存放语法树的缓冲区
+ */
+static void run_stages(RegexNode* root, FlatRegex::Node flat_root, size_t estimated_states,
+                       const Options &opt, Workspace &ws) {
+    RegexNodePool &pool = ws.pool;
+    Clock::time_point t;
+
+    // 1.2 划分字节等价类；化简与分解不会引入新的字节
+    ByteClasses alphabet;
+    if (opt.flat) alphabet.collect(ws.flat);
+    else alphabet.collect(root);
+    if (opt.stats) cerr << "alphabet: " << alphabet.size() << " byte classes\n";
+
+    // 1.5 化简语法树、分解并运算(可选)
+    if (opt.simplify && root) {
+        long long before = Thompson::count_states(root);
+        RegexSimplifier simp(pool);
+        root = simp.simplify(root);
+        if (opt.stats) {
+            long long after = Thompson::count_states(root);
+            cerr << "simplify: " << simp.rewrites() << " rewrites, NFA states "
+                 << before << " -> " << after << " (saved " << before-after << ")\n";
+        }
+    }
+    if (opt.factor && root) {
+        long long before = Thompson::count_states(root);
+        UnionFactorer uf(pool);
+        root = uf.factor(root);
+        if (opt.stats) {
+            long long after = Thompson::count_states(root);
+            cerr << "factor: " << uf.chains() << " union chains, NFA states "
+                 << before << " -> " << after << " (saved " << before-after << ")\n";
+        }
+    }
+
+    // 2~4. Brzozowski导数直接得到DFA；否则先构造无ε转移的NFA，再做子集构造。
+    //      不支持树中某些运算符的构造方法改用Thompson构造
+    Options::Construction method = opt.construction;
+    bool supported = true;
+    if (method==Options::DERIVATIVE) {
+        supported = opt.flat?RegexTerms::convertible(ws.flat):RegexTerms::convertible(root);
+    } else if (method==Options::GLUSHKOV || method==Options::FOLLOW) {
+        supported = opt.flat?Glushkov::supports(ws.flat):Glushkov::supports(root);
+    } else if (method==Options::ANTIMIROV) {
+        supported = opt.flat?PartialDerivativeConstruction::supports(ws.flat)
+                            :PartialDerivativeConstruction::supports(root);
+    }
+    if (!supported) {
+        if (opt.stats) cerr << Options::construction_name(method) << ": unsupported operator, using thompson\n";
+        method = Options::THOMPSON;
+    }
+    DFA dfa;
+    if (method==Options::DERIVATIVE) {
+        t = Clock::now();
+        DerivativeConstruction dc = opt.flat?DerivativeConstruction(ws.flat,flat_root,alphabet)
+                                            :DerivativeConstruction(root,alphabet);
+        dfa = dc.build();
+        if (opt.stats) {
+            cerr << "derivative: " << dfa.states.size() << " states, " << dc.term_count() << " terms, "
+                 << elapsed_ms(t) << " ms\n";
+        }
+    } else {
+        // 2. 构造NFA：Glushkov构造与Antimirov偏导数直接得到无ε转移的NFA，
+        //    Thompson构造得到ε-NFA
+        NFA nfa;
+        t = Clock::now();
+        if (method==Options::ANTIMIROV) {
+            PartialDerivativeConstruction pd = opt.flat?PartialDerivativeConstruction(ws.flat,flat_root,alphabet)
+                                                       :PartialDerivativeConstruction(root,alphabet);
+            nfa = pd.build();
+        } else if (method==Options::GLUSHKOV || method==Options::FOLLOW) {
+            Glushkov gl = opt.flat?Glushkov(ws.flat,flat_root,alphabet):Glushkov(root,alphabet);
+            nfa = gl.build();
+        } else {
+            Thompson th = opt.flat?Thompson(ws.flat,flat_root,alphabet):Thompson(root,alphabet,pool.is_interning());
+            th.reserve(estimated_states);
+            th.set_materialize(opt.materialize);
+            nfa = th.build();
+            if (opt.stats && th.product_states() > 0) {
+                cerr << "product (" << (opt.materialize?"materialized":"lazy") << "): "
+                     << th.product_states() << " states, " << th.product_ms() << " ms\n";
+            }
+        }
+        const char* built = method==Options::ANTIMIROV?"antimirov"
+                          :(method==Options::THOMPSON || method==Options::COMPACT)?"thompson":"glushkov";
+        if (opt.stats) {
+            cerr << built << ": " << nfa.states.size() << " states, " << nfa.edges() << " edges, "
+                 << elapsed_ms(t) << " ms\n";
+        }
+
+        // 2.5 收缩ε链并合并出边相同的状态(compact)；位置自动机合并为follow自动机(follow)
+        if (method==Options::COMPACT || method==Options::FOLLOW) {
+            t = Clock::now();
+            size_t states = nfa.states.size(), edges = nfa.edges();
+            if (method==Options::COMPACT) nfa = NFACompactor::contract_epsilon(nfa);
+            nfa = NFACompactor::merge_equivalent(nfa);
+            if (opt.stats) {
+                cerr << Options::construction_name(method) << ": " << states << " -> " << nfa.states.size()
+                     << " states, " << edges << " -> " << nfa.edges() << " edges, " << elapsed_ms(t) << " ms\n";
+            }
+        }
+
+        // 2.6 冻结为按符号分块的CSR形式，之后的阶段只读；可选按遍历顺序重新编号
+        t = Clock::now();
+        FrozenNFA frozen(nfa);
+        nfa = NFA();
+        if (opt.stats) {
+            cerr << "freeze: " << frozen.bytes() << " bytes, " << elapsed_ms(t) << " ms\n";
+        }
+        if (opt.renumber!=NFARenumberer::CREATION) {
+            t = Clock::now();
+            frozen = NFARenumberer::renumber(frozen,opt.renumber);
+            if (opt.stats) {
+                cerr << "renumber (" << NFARenumberer::order_name(opt.renumber) << "): " << frozen.size()
+                     << " states, " << elapsed_ms(t) << " ms\n";
+            }
+        }
 
-    // 1. 解析正则表达式
-    RegexParser parser(re);
-    RegexNode* root = parser.parse();
+        // 3. ε-NFA -> NFA
+        if (frozen.has_epsilon()) {
+            t = Clock::now();
+            EpsilonRemover er(frozen);
+            frozen = er.remove();
+            if (opt.stats) {
+                cerr << "epsilon: " << frozen.size() << " states, " << frozen.edges() << " edges, "
+                     << er.components() << " closure components, " << elapsed_ms(t) << " ms\n";
+            }
+        }
 
-    // 2. Thompson构造ε-NFA
-    Thompson th(root);
-    NFA enfa = th.build();
+        // 3.4 删去不可达和到达不了接受态的状态
+        t = Clock::now();
+        int before = frozen.size();
+        frozen = NFATrimmer::trim(frozen);
+        if (opt.stats) {
+            cerr << "trim: " << before << " -> " << frozen.size() << " states, dropped " << before-frozen.size()
+                 << ", " << elapsed_ms(t) << " ms\n";
+        }
 
-    // 3. ε-NFA -> NFA
-    EpsilonRemover er(enfa);
-    NFA nfa = er.remove();
+        // 3.5 按互模拟合并状态，可选按模拟关系删减子集
+        vector<vector<int>> dominated_by;
+        if (opt.reduce!=NFAReducer::NONE) {
+            t = Clock::now();
+            size_t states = frozen.size(), edges = frozen.edges();
+            frozen = NFAReducer::bisimulation(frozen);
+            if (opt.stats) {
+                cerr << "bisimulation: " << states << " -> " << frozen.size() << " states, " << edges << " -> "
+                     << frozen.edges() << " edges, " << elapsed_ms(t) << " ms\n";
+            }
+        }
+        if (opt.reduce==NFAReducer::SIMULATION) {
+            if (NFAReducer::simulation_cells(frozen)<=NFAReducer::SIMULATION_LIMIT) {
+                t = Clock::now();
+                dominated_by = NFAReducer::simulation(frozen);
+                if (opt.stats) {
+                    int n = 0;
+                    for (auto &d: dominated_by) n += !d.empty();
+                    cerr << "simulation: " << n << " of " << frozen.size() << " states dominated, "
+                         << elapsed_ms(t) << " ms\n";
+                }
+            } else if (opt.stats) {
+                cerr << "simulation: skipped, " << frozen.size() << " states\n";
+            }
+        }
 
-    // 4. NFA -> DFA (子集构造)
-    SubsetConstruction sc(nfa);
-    DFA dfa = sc.convert();
+        // 4. NFA -> DFA (子集构造)
+        t = Clock::now();
+        SubsetConstruction sc(frozen);
+        if (!dominated_by.empty()) sc.prune_with(move(dominated_by));
+        dfa = sc.convert();
+        if (opt.stats) {
+            cerr << "subset: " << dfa.states.size() << " states, mean set size " << sc.mean_set_size() << ", "
+                 << elapsed_ms(t) << " ms\n";
+        }
+    }
 
     // 5. 最小化DFA
+    t = Clock::now();
     DFAMinimizer dm(dfa);
     DFA mdfa = dm.minimize();
+    if (opt.stats) cerr << "minimize: " << mdfa.states.size() << " states, " << elapsed_ms(t) << " ms\n";
 
     // 6. 输出最小化DFA及RG
     DFAPrinter printer(mdfa);
     printer.print_and_convert_to_RG();
+}
+
+/**
+ * @brief 对一个正则表达式执行 解析 -> ε-NFA -> NFA -> DFA -> 最小化DFA -> RG 的完整流程
+ * @param re 正则表达式输入
+ * @param opt 命令行选项
+ * @param ws 复用的缓冲区，开始时会被清空
+ * @throw RegexError 正则表达式不合法
+ */
+static void run_pipeline(const RegexInput &re, const Options &opt, Workspace &ws) {
+    RegexNodePool &pool = ws.pool;
+    pool.reset();
+    pool.set_interning(opt.intern);
+    ws.flat.clear();
+
+    // 1. 解析正则表达式；扁平语法树不经过下面基于指针树的化简与分解
+    Clock::time_point t = Clock::now();
+    FlatRegex::Node flat_root = FlatRegex::NONE;
+    RegexNode* root = nullptr;
+    if (opt.flat) {
+        FlatRegexParser parser(ws.flat);
+        flat_root = re.parse_with(parser,ws.scanner);
+    } else {
+        // 映射的文件与批处理的一行在整个流程中有效，字面量串不必复制
+        pool.borrow_text(re.memory(),re.memory_size());
+        RegexParser parser(pool);
+        root = re.parse_with(parser,ws.scanner);
+    }
+    if (opt.stats) {
+        cerr << "parse: " << (opt.flat?ws.flat.size():pool.size()) << " nodes, "
+             << elapsed_ms(t) << " ms\n";
+    }
+
+    run_stages(root,flat_root,ws.scanner.estimated_states(),opt,ws);
+}
+
+/**
+ * @brief 对用构造器组合的表达式执行完整流程，跳过文本解析
+ * @param e 用regex_expr.h组合的表达式
+ * @param opt 命令行选项
+ * @param ws 复用的缓冲区，开始时会被清空
+ */
+template<class E>
+static void run_pipeline(const regex_expr::Expr<E> &e, const Options &opt, Workspace &ws) {
+    RegexNodePool &pool = ws.pool;
+    pool.reset();
+    pool.set_interning(opt.intern);
+    ws.flat.clear();
+
+    Clock::time_point t = Clock::now();
+    FlatRegex::Node flat_root = FlatRegex::NONE;
+    RegexNode* root = nullptr;
+    if (opt.flat) {
+        ExprBuilder<FlatRegex> b(ws.flat);
+        flat_root = e.self().build(b);
+    } else {
+        ExprBuilder<RegexNodePool> b(pool);
+        root = e.self().build(b);
+    }
+    size_t nodes = opt.flat?ws.flat.size():pool.size();
+    if (opt.stats) cerr << "build: " << nodes << " nodes, " << elapsed_ms(t) << " ms\n";
+    run_stages(root,flat_root,2*nodes+2,opt,ws);
+}
+
+/**
+ * @brief 批处理：逐行读取正则表达式并依次处理，缓冲区在各行之间复用
+ *
+ * 每个结果以"# regex <序号>"开头、以"# time <毫秒> ms"结尾；空行被跳过；
+ * 不合法的正则表达式输出"# error <描述>"，不影响后续各行。
+ * @param in 输入流
+ * @param opt 命令行选项
+ */
+static void run_batch(istream &in, const Options &opt) {
+    Workspace ws;
+    string line;
+    long long index = 0;
+    while (getline(in,line)) {
+        if (!line.empty() && line.back()=='\r') line.pop_back();
+        if (line.empty()) continue;
+        index++;
+        cout << "# regex " << index << "\n";
+        Clock::time_point t = Clock::now();
+        try {
+            run_pipeline(RegexInput::from_memory(line.data(),line.size()),opt,ws);
+        } catch (const RegexError &e) {
+            cout << "# error " << e.what() << "\n";
+        }
+        cout << "# time " << elapsed_ms(t) << " ms\n";
+    }
+}
+
+//-------------------- main --------------------
+
+// 测试程序定义RG_NO_MAIN后包含本文件，直接调用run_pipeline()等函数
+#ifndef RG_NO_MAIN
+/**
+ * @brief 主函数，执行正则表达式->最小化DFA->RG转换的完整流程
+ */
+int main(int argc, char* argv[]) {
+    ios::sync_with_stdio(false);
+    cin.tie(nullptr);
+
+    Options opt;
+    for (int i=1; i<argc; i++) {
+        string arg = argv[i];
+        if (arg=="--intern") opt.intern = true;
+        else if (arg=="--simplify") opt.simplify = true;
+        else if (arg=="--factor") opt.factor = true;
+        else if (arg=="--flat") opt.flat = true;
+        else if (arg=="--stats") opt.stats = true;
+        else if (arg=="--materialize") opt.materialize = true;
+        else if (arg.compare(0,11,"--renumber=")==0) {
+            string v = arg.substr(11);
+            int o = NFARenumberer::CREATION;
+            while (o<=NFARenumberer::DFS && v!=NFARenumberer::order_name((NFARenumberer::Order)o)) o++;
+            if (o>NFARenumberer::DFS) {
+                cerr << "unknown renumbering order " << v << "\n";
+                return 1;
+            }
+            opt.renumber = (NFARenumberer::Order)o;
+        }
+        else if (arg.compare(0,9,"--reduce=")==0) {
+            string v = arg.substr(9);
+            int m = NFAReducer::NONE;
+            while (m<=NFAReducer::SIMULATION && v!=NFAReducer::mode_name((NFAReducer::Mode)m)) m++;
+            if (m>NFAReducer::SIMULATION) {
+                cerr << "unknown reduction " << v << "\n";
+                return 1;
+            }
+            opt.reduce = (NFAReducer::Mode)m;
+        }
+        else if (arg.compare(0,15,"--construction=")==0) {
+            string v = arg.substr(15);
+            int c = Options::THOMPSON;
+            while (c<=Options::DERIVATIVE && v!=Options::construction_name((Options::Construction)c)) c++;
+            if (c>Options::DERIVATIVE) {
+                cerr << "unknown construction " << v << "\n";
+                return 1;
+            }
+            opt.construction = (Options::Construction)c;
+        }
+        else if (arg=="--batch") {
+            opt.batch = true;
+            if (i+1<argc && argv[i+1][0]!='-') opt.batch_file = argv[++i];
+        }
+        else if (arg=="--file") {
+            if (i+1>=argc) {
+                cerr << "missing file name after --file\n";
+                return 1;
+            }
+            opt.input_file = argv[++i];
+        }
+        else {
+            cerr << "unknown option " << arg << "\n";
+            return 1;
+        }
+    }
+
+    if (opt.batch) {
+        // --batch --file 文件 与 --batch 文件 相同；两处都给出文件时无法确定读哪一个
+        if (!opt.input_file.empty()) {
+            if (!opt.batch_file.empty()) {
+                cerr << "--file cannot be combined with --batch " << opt.batch_file << "\n";
+                return 1;
+            }
+            opt.batch_file = opt.input_file;
+        }
+        if (opt.batch_file.empty()) {
+            run_batch(cin,opt);
+        } else {
+            ifstream fin(opt.batch_file);
+            if (!fin) {
+                cerr << "cannot open " << opt.batch_file << "\n";
+                return 1;
+            }
+            run_batch(fin,opt);
+        }
+        return 0;
+    }
+
+    Workspace ws;
+    try {
+        if (!opt.input_file.empty()) {
+            MappedFile file(opt.input_file);
+            if (!file.ok()) {
+                cerr << "cannot open " << opt.input_file << "\n";
+                return 1;
+            }
+            run_pipeline(RegexInput::from_memory(file.data(),file.size()),opt,ws);
+        } else {
+            run_pipeline(RegexInput::from_stream(cin),opt,ws);
+        }
+    } catch (const RegexError &e) {
+        cerr << "error: " << e.what() << "\n";
+        return 1;
+    }
 
     return 0;
 }
+#endif
@@ -0,0 +1,300 @@
+/**
+ * @file regex_expr.h
+ * @brief 正则表达式构造器：用函数和运算符直接组合表达式，不经过拼接字符串和文本解析
+ *
+ * 用法：
+ * @code
+ * using namespace regex_expr;
+ * auto e = *(lit('0') | '1') >> '1' >> repeat(alt('0', '1'), 3, 3);   // (0+1)*1(0+1){3}
+ * auto k = alt_of(words) >> star('0');                                 // (w1+w2+...)0*
+ * Node root = e.build(builder);
+ * @endcode
+ *
+ * 组合结果是一个轻量的值，其类型记录了表达式的结构；build(builder)按后序
+ * 调用builder，生成与解析器相同的语法树。运算符的C++优先级与正则语法一致：
+ * a>>b为连接，a&b为交，a|b为并，优先级依次降低，均为左结合；*a为闭包，
+ * ~a为补，二者只作用于紧随其后的操作数(正则语法中的~r作用于其后的整个连接式，
+ * 这里须写作~(a>>b))。运算符至少一侧须为表达式，另一侧可以是char或字面量串；
+ * 其他整数类型不被接受，以免'b'+'c'之类的整数运算结果被悄悄当作一个字节。
+ *
+ * Builder须提供：
+ * @code
+ * typedef ... Node;
+ * Node epsilon();                                  // 空串
+ * Node byte(char c);                               // 单个字面量字节
+ * Node string(const char *s, int n);               // 字面量串，n>0
+ * Node byte_class(const std::bitset<256> &bytes);  // 字节字符类
+ * Node code_class(const std::vector<CodeRange> &); // 码点类，区间升序且互不相交
+ * Node binary(Op op, Node l, Node r);              // CONCAT、UNION或AND
+ * Node unary(Op op, Node a);                       // STAR或NOT
+ * Node repeat(Node a, int lo, int hi);             // a{lo,hi}，hi可为UNBOUNDED
+ * @endcode
+ */
+#ifndef REGEX_EXPR_H
+#define REGEX_EXPR_H
+
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace regex_expr {
+
+/**
+ * @brief 参数不合法(区间为空、重复次数上下界颠倒等)时抛出的异常
+ */
+struct Error : std::invalid_argument {
+    explicit Error(const char *msg) :std::invalid_argument(msg){}
+};
+
+enum Op { CONCAT, UNION, AND, STAR, NOT }; ///< 运算的种类
+
+typedef std::pair<uint32_t,uint32_t> CodeRange; ///< 码点闭区间[first,second]
+
+static const int UNBOUNDED = -1;                 ///< repeat()没有上界时的hi
+static const uint32_t MAX_CODE_POINT = 0x10FFFF; ///< 最大的Unicode码点
+
+/**
+ * @brief 表达式模板的基类(CRTP)，只用于约束运算符重载的参数
+ */
+template<class E>
+struct Expr {
+    const E& self() const { return static_cast<const E&>(*this); } ///< 实际的表达式
+};
+
+/**
+ * @brief 单个字面量字节
+ */
+struct CharExpr : Expr<CharExpr> {
+    char c;
+    explicit CharExpr(char c) :c(c){}
+    template<class Builder>
+    typename Builder::Node build(Builder &b) const { return b.byte(c); }
+};
+
+/**
+ * @brief 字面量串，空串对应空串表达式
+ */
+struct StringExpr : Expr<StringExpr> {
+    std::string s;
+    explicit StringExpr(std::string s) :s(std::move(s)){}
+    template<class Builder>
+    typename Builder::Node build(Builder &b) const {
+        if (s.empty()) return b.epsilon();
+        return b.string(s.data(),(int)s.size());
+    }
+};
+
+/**
+ * @brief 字节字符类
+ */
+struct ClassExpr : Expr<ClassExpr> {
+    std::bitset<256> bytes;
+    explicit ClassExpr(const std::bitset<256> &bytes) :bytes(bytes){}
+    template<class Builder>
+    typename Builder::Node build(Builder &b) const { return b.byte_class(bytes); }
+};
+
+/**
+ * @brief Unicode码点类
+ */
+struct CodeClassExpr : Expr<CodeClassExpr> {
+    std::vector<CodeRange> ranges; ///< 升序且互不相交的码点区间
+    explicit CodeClassExpr(std::vector<CodeRange> ranges) :ranges(std::move(ranges)){}
+    template<class Builder>
+    typename Builder::Node build(Builder &b) const { return b.code_class(ranges); }
+};
+
+/**
+ * @brief 二元运算(CONCAT、UNION或AND)
+ */
+template<Op T, class A, class B>
+struct BinaryExpr : Expr<BinaryExpr<T,A,B>> {
+    A a;
+    B b;
+    BinaryExpr(const A &a, const B &b) :a(a),b(b){}
+    template<class Builder>
+    typename Builder::Node build(Builder &builder) const {
+        typename Builder::Node l = a.build(builder);
+        typename Builder::Node r = b.build(builder);
+        return builder.binary(T,l,r);
+    }
+};
+
+/**
+ * @brief 一元运算(STAR或NOT)
+ */
+template<Op T, class A>
+struct UnaryExpr : Expr<UnaryExpr<T,A>> {
+    A a;
+    explicit UnaryExpr(const A &a) :a(a){}
+    template<class Builder>
+    typename Builder::Node build(Builder &b) const { return b.unary(T,a.build(b)); }
+};
+
+/**
+ * @brief 有界重复a{lo,hi}
+ */
+template<class A>
+struct RepeatExpr : Expr<RepeatExpr<A>> {
+    A a;
+    int lo, hi;
+    RepeatExpr(const A &a, int lo, int hi) :a(a),lo(lo),hi(hi){}
+    template<class Builder>
+    typename Builder::Node build(Builder &b) const { return b.repeat(a.build(b),lo,hi); }
+};
+
+/**
+ * @brief 列表中的一项生成节点：表达式按其结构生成，字节与串作为字面量
+ */
+template<class Builder, class E>
+typename Builder::Node build_item(Builder &b, const Expr<E> &e) { return e.self().build(b); }
+template<class Builder>
+typename Builder::Node build_item(Builder &b, char c) { return b.byte(c); }
+template<class Builder>
+typename Builder::Node build_item(Builder &b, const std::string &s) {
+    if (s.empty()) return b.epsilon();
+    return b.string(s.data(),(int)s.size());
+}
+
+/**
+ * @brief 运行时数目不定的同类项的连接或并，按左结合生成；空列表对应空串
+ *
+ * 项列表由各副本共享，组合进更大的表达式时不复制列表。
+ */
+template<Op T, class A>
+struct ListExpr : Expr<ListExpr<T,A>> {
+    static_assert(!std::is_integral<A>::value || std::is_same<A,char>::value,
+                  "list items must be expressions, char or strings");
+    std::shared_ptr<const std::vector<A>> items;
+    explicit ListExpr(std::vector<A> v) :items(std::make_shared<const std::vector<A>>(std::move(v))){}
+    template<class Builder>
+    typename Builder::Node build(Builder &b) const {
+        if (items->empty()) return b.epsilon();
+        typename Builder::Node n = build_item(b,(*items)[0]);
+        for (size_t i=1; i<items->size(); i++) {
+            typename Builder::Node r = build_item(b,(*items)[i]);
+            n = b.binary(T,n,r);
+        }
+        return n;
+    }
+};
+
+inline CharExpr lit(char c) { return CharExpr(c); }                             ///< 字面量字节
+inline StringExpr lit(std::string s) { return StringExpr(std::move(s)); }       ///< 字面量串
+inline StringExpr lit(const char *s) { return StringExpr(s); }                  ///< 字面量串
+inline ClassExpr one_of(const std::bitset<256> &bytes) { return ClassExpr(bytes); } ///< 字节字符类
+
+/**
+ * @brief 字节区间[lo,hi]
+ */
+inline ClassExpr range(unsigned char lo, unsigned char hi) {
+    std::bitset<256> bytes;
+    for (int b=lo; b<=hi; b++) bytes.set(b);
+    return ClassExpr(bytes);
+}
+
+/**
+ * @brief 码点区间[lo,hi]，按UTF-8编码匹配，其中的代理项被去掉
+ * @throw Error 区间为空、超出MAX_CODE_POINT或只含代理项
+ */
+inline CodeClassExpr code_range(uint32_t lo, uint32_t hi) {
+    if (hi < lo || hi > MAX_CODE_POINT) throw Error("invalid code point range");
+    std::vector<CodeRange> ranges;
+    if (lo < 0xD800) ranges.push_back({lo,hi<0xD7FF?hi:0xD7FF});
+    if (hi > 0xDFFF) ranges.push_back({lo>0xE000?lo:0xE000,hi});
+    if (ranges.empty()) throw Error("invalid code point range");
+    return CodeClassExpr(std::move(ranges));
+}
+
+template<class E> const E& as_expr(const Expr<E> &e) { return e.self(); } ///< 表达式本身
+inline CharExpr as_expr(char c) { return CharExpr(c); }                  ///< 字节视为字面量
+inline StringExpr as_expr(const char *s) { return StringExpr(s); }       ///< 串视为字面量
+inline StringExpr as_expr(const std::string &s) { return StringExpr(s); } ///< 串视为字面量
+/// char以外的整数(包括'b'+'c'的结果)不是字面量
+template<class T, class = std::enable_if_t<std::is_integral<T>::value>>
+CharExpr as_expr(T) = delete;
+
+template<class A>
+using AsExpr = std::decay_t<decltype(as_expr(std::declval<A>()))>; ///< 参数对应的表达式类型
+
+/**
+ * @brief 连接a b...，参数可以是表达式、字节或字面量串
+ */
+template<class A, class B>
+BinaryExpr<CONCAT,AsExpr<A>,AsExpr<B>> seq(const A &a, const B &b) { return {as_expr(a),as_expr(b)}; }
+template<class A, class B, class C, class... Rest>
+auto seq(const A &a, const B &b, const C &c, const Rest&... rest) { return seq(seq(a,b),c,rest...); }
+
+/**
+ * @brief 并a+b+...，参数可以是表达式、字节或字面量串
+ */
+template<class A, class B>
+BinaryExpr<UNION,AsExpr<A>,AsExpr<B>> alt(const A &a, const B &b) { return {as_expr(a),as_expr(b)}; }
+template<class A, class B, class C, class... Rest>
+auto alt(const A &a, const B &b, const C &c, const Rest&... rest) { return alt(alt(a,b),c,rest...); }
+
+/**
+ * @brief 列表中各项的连接，项可以是同一类型的表达式、字节或字面量串
+ */
+template<class A>
+ListExpr<CONCAT,A> seq_of(std::vector<A> items) { return ListExpr<CONCAT,A>(std::move(items)); }
+
+/**
+ * @brief 列表中各项的并，如一组运行时给定的关键字
+ */
+template<class A>
+ListExpr<UNION,A> alt_of(std::vector<A> items) { return ListExpr<UNION,A>(std::move(items)); }
+
+/**
+ * @brief 交a&b
+ */
+template<class A, class B>
+BinaryExpr<AND,AsExpr<A>,AsExpr<B>> both(const A &a, const B &b) { return {as_expr(a),as_expr(b)}; }
+
+/**
+ * @brief 闭包a*
+ */
+template<class A>
+UnaryExpr<STAR,AsExpr<A>> star(const A &a) { return UnaryExpr<STAR,AsExpr<A>>(as_expr(a)); }
+
+/**
+ * @brief 补~a
+ */
+template<class A>
+UnaryExpr<NOT,AsExpr<A>> complement(const A &a) { return UnaryExpr<NOT,AsExpr<A>>(as_expr(a)); }
+
+/**
+ * @brief 有界重复a{lo,hi}，hi为UNBOUNDED时表示a{lo,}
+ * @throw Error 上下界不合法
+ */
+template<class A>
+RepeatExpr<AsExpr<A>> repeat(const A &a, int lo, int hi) {
+    if (lo < 0 || (hi != UNBOUNDED && hi < lo)) throw Error("invalid repetition bounds");
+    return RepeatExpr<AsExpr<A>>(as_expr(a),lo,hi);
+}
+
+/**
+ * @brief 是否为表达式类型；运算符至少一侧须为表达式
+ */
+template<class T>
+using IsExpr = std::is_base_of<Expr<T>,T>;
+
+template<class A, class B, class = std::enable_if_t<IsExpr<A>::value || IsExpr<B>::value>>
+auto operator>>(const A &a, const B &b) -> decltype(seq(a,b)) { return seq(a,b); }
+template<class A, class B, class = std::enable_if_t<IsExpr<A>::value || IsExpr<B>::value>>
+auto operator&(const A &a, const B &b) -> decltype(both(a,b)) { return both(a,b); }
+template<class A, class B, class = std::enable_if_t<IsExpr<A>::value || IsExpr<B>::value>>
+auto operator|(const A &a, const B &b) -> decltype(alt(a,b)) { return alt(a,b); }
+template<class A>
+UnaryExpr<STAR,A> operator*(const Expr<A> &a) { return UnaryExpr<STAR,A>(a.self()); }
+template<class A>
+UnaryExpr<NOT,A> operator~(const Expr<A> &a) { return UnaryExpr<NOT,A>(a.self()); }
+
+} // namespace regex_expr
+
+#endif
@@ -0,0 +1,406 @@
+/**
+ * @file static_regex.h
+ * @brief 编译期正则表达式：在常量求值中完成解析、构造与最小化
+ *
+ * 用法：
+ * @code
+ * constexpr auto re = static_regex::compile("(0+1)*1(0+1)");
+ * static_assert(re.match("0110"), "");
+ * bool ok = re.match(buf,len);   // 运行期只剩查表
+ * @endcode
+ *
+ * 语法与主程序一致：字面量字节、"\c"、"\xHH"、ASCII范围内的"\u{...}"、
+ * 字符类[...]/[^...]、括号、'+'、'*'与"{m}"/"{m,}"/"{m,n}"。
+ * 交'&'、补'~'以及含非ASCII码点的字符类不支持，需要时走运行期流水线。
+ *
+ * 构造采用Glushkov位置自动机：每个字面量位置占一位，first/last/follow集合都是
+ * 64位掩码，因此位置数不超过63(第63位表示初始状态)；"{m,n}"按副本展开计入位置数。
+ * 字节按"被哪些位置接受"划分为等价类，子集构造后用Moore算法最小化，
+ * 结果(含陷阱态)与运行期流水线得到的最小DFA的可达部分同构。
+ * 语法错误或容量不足在常量求值中抛出异常，表现为编译错误。
+ */
+#ifndef STATIC_REGEX_H
+#define STATIC_REGEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+namespace static_regex {
+
+/**
+ * @brief 正则表达式不合法或超出编译期容量时抛出的异常
+ */
+struct Error : std::invalid_argument {
+    explicit Error(const char *msg) :std::invalid_argument(msg){}
+};
+
+/**
+ * @brief 编译得到的最小DFA
+ * @tparam MaxStates 状态数上限
+ * @tparam MaxClasses 字节等价类数上限
+ *
+ * 状态0为初始状态；表中包含陷阱态，任意字节串都有确定的转移。
+ */
+template <int MaxStates, int MaxClasses>
+struct Dfa {
+    int states = 0;                       ///< 状态数
+    int classes = 0;                      ///< 字节等价类数
+    unsigned char cls[256] = {};          ///< 每个字节所属的等价类
+    int next[MaxStates][MaxClasses] = {}; ///< 转移表，next[状态][等价类]
+    bool accept[MaxStates] = {};          ///< 是否为终态
+
+    /**
+     * @brief 状态s读入字节b后的状态
+     */
+    constexpr int step(int s, unsigned char b) const { return next[s][cls[b]]; }
+
+    /**
+     * @brief 判断[s,s+n)是否完整匹配
+     */
+    constexpr bool match(const char *s, std::size_t n) const {
+        int q = 0;
+        for (std::size_t i=0; i<n; i++) q = step(q,(unsigned char)s[i]);
+        return accept[q];
+    }
+
+    /**
+     * @brief 判断字符串字面量是否完整匹配
+     */
+    template <std::size_t N>
+    constexpr bool match(const char (&s)[N]) const { return match(s,N-1); }
+
+    bool match(const std::string &s) const { return match(s.data(),s.size()); }
+};
+
+namespace detail {
+
+static constexpr int MAX_POSITIONS = 63;                   ///< 位置数上限
+static constexpr std::uint64_t INITIAL = 1ull<<MAX_POSITIONS; ///< 子集中表示初始状态的位
+
+/**
+ * @brief 256位的字节集合
+ */
+struct Bytes {
+    std::uint64_t w[4] = {};
+
+    constexpr void add(unsigned b) { w[b>>6] |= 1ull<<(b&63); }
+    constexpr bool has(unsigned b) const { return (w[b>>6]>>(b&63))&1; }
+    constexpr void add_range(unsigned lo, unsigned hi) { for (unsigned b=lo; b<=hi; b++) add(b); }
+    constexpr void invert() { for (auto &x: w) x = ~x; }
+};
+
+/**
+ * @brief 子表达式的Glushkov摘要
+ */
+struct Frag {
+    std::uint64_t first = 0; ///< 可作为首字节的位置
+    std::uint64_t last = 0;  ///< 可作为末字节的位置
+    bool nullable = true;    ///< 是否接受空串
+};
+
+/**
+ * @brief 递归下降解析并同时计算follow集合
+ *
+ * 优先级与主程序相同：后缀'*'/"{m,n}"高于连接高于'+'。
+ * 重复次数通过回退已分配的位置、重新解析操作数文本来生成副本。
+ */
+struct Glushkov {
+    const char *re = nullptr;
+    std::size_t n = 0;
+    int positions = 0;                           ///< 已分配的位置数
+    Bytes sym[MAX_POSITIONS] = {};               ///< 每个位置接受的字节
+    std::uint64_t follow[MAX_POSITIONS] = {};    ///< 每个位置的follow集合
+
+    constexpr Glushkov(const char *r, std::size_t len) :re(r),n(len){}
+
+    static constexpr int hex_value(char c) {
+        return c>='0' && c<='9' ? c-'0' : c>='a' && c<='f' ? c-'a'+10 : c>='A' && c<='F' ? c-'A'+10 : -1;
+    }
+
+    constexpr Frag position(const Bytes &b) {
+        if (positions == MAX_POSITIONS) throw Error("too many positions for static_regex");
+        sym[positions] = b;
+        follow[positions] = 0;
+        Frag f;
+        f.first = f.last = 1ull<<positions++;
+        f.nullable = false;
+        return f;
+    }
+
+    constexpr Frag join(const Frag &a, const Frag &b) {
+        for (int p=0; p<positions; p++) if ((a.last>>p)&1) follow[p] |= b.first;
+        Frag f;
+        f.first = a.first|(a.nullable?b.first:0);
+        f.last = b.last|(b.nullable?a.last:0);
+        f.nullable = a.nullable && b.nullable;
+        return f;
+    }
+
+    constexpr Frag star(Frag f) {
+        for (int p=0; p<positions; p++) if ((f.last>>p)&1) follow[p] |= f.first;
+        f.nullable = true;
+        return f;
+    }
+
+    /**
+     * @brief 读入转义序列(i指向'\'之后)，返回字节或码点
+     */
+    constexpr std::uint32_t escape(std::size_t &i) {
+        if (i >= n) throw Error("incomplete escape");
+        char c = re[i++];
+        if (c == 'x') {
+            if (i+2 > n || hex_value(re[i]) < 0 || hex_value(re[i+1]) < 0) throw Error("invalid hex escape");
+            i += 2;
+            return (std::uint32_t)(hex_value(re[i-2])*16+hex_value(re[i-1]));
+        }
+        if (c == 'u') {
+            if (i >= n || re[i] != '{') throw Error("expected '{' after \\u");
+            std::uint32_t v = 0;
+            int digits = 0;
+            for (i++; i<n && re[i]!='}'; i++) {
+                if (hex_value(re[i]) < 0 || ++digits > 6) throw Error("invalid \\u escape");
+                v = v*16+(std::uint32_t)hex_value(re[i]);
+            }
+            if (i >= n || digits == 0) throw Error("invalid \\u escape");
+            i++;
+            if (v >= 0x80) throw Error("non-ASCII code points are not supported by static_regex");
+            return v;
+        }
+        return (unsigned char)c;
+    }
+
+    /**
+     * @brief 读入字符类(i指向'['之后)
+     */
+    constexpr Frag char_class(std::size_t &i) {
+        Bytes set;
+        bool negate = false;
+        if (i < n && re[i] == '^') { negate = true; i++; }
+        if (i < n && re[i] == ']') throw Error("empty character class");
+        while (true) {
+            if (i >= n) throw Error("unterminated '['");
+            if (re[i] == ']') break;
+            std::uint32_t lo = item(i);
+            if (i+1 < n && re[i] == '-' && re[i+1] != ']') {
+                i++;
+                std::uint32_t hi = item(i);
+                if (hi < lo) throw Error("invalid range in character class");
+                set.add_range(lo,hi);
+            } else {
+                set.add(lo);
+            }
+        }
+        i++;
+        if (negate) set.invert();
+        return position(set);
+    }
+
+    constexpr std::uint32_t item(std::size_t &i) {
+        unsigned char c = (unsigned char)re[i++];
+        if (c < 0x20) throw Error("unexpected control character");
+        if (c >= 0x80) throw Error("non-ASCII character classes are not supported by static_regex");
+        return c == '\\' ? escape(i) : c;
+    }
+
+    constexpr Frag atom(std::size_t &i) {
+        unsigned char c = (unsigned char)re[i++];
+        Bytes b;
+        switch (c) {
+            case '(': {
+                Frag f = alt(i);
+                if (i >= n) throw Error("unmatched '('");
+                i++;
+                return f;
+            }
+            case '[': return char_class(i);
+            case '\\': b.add(escape(i)); return position(b);
+            case '*': throw Error("'*' without operand");
+            case '{': throw Error("'{' without operand");
+            case ']': throw Error("unmatched ']'");
+            case '}': throw Error("unmatched '}'");
+            case '&': case '~': throw Error("'&' and '~' are not supported by static_regex");
+            default:
+                if (c < 0x20) throw Error("unexpected control character");
+                b.add(c);
+                return position(b);
+        }
+    }
+
+    /**
+     * @brief 读入"{m}"、"{m,}"或"{m,n}"(i指向'{')，上界-1表示无上界
+     */
+    constexpr void bounds(std::size_t &i, int &lo, int &hi) {
+        int digits = 0;
+        bool comma = false;
+        lo = 0;
+        hi = 0;
+        for (i++; ; i++) {
+            if (i >= n) throw Error("unterminated '{'");
+            char c = re[i];
+            if (c >= '0' && c <= '9') {
+                int &v = comma?hi:lo;
+                v = v*10+(c-'0');
+                digits++;
+                if (v > MAX_POSITIONS) throw Error("repetition count too large for static_regex");
+            } else if (c == ',' && !comma && digits > 0) {
+                comma = true;
+                digits = 0;
+            } else if (c == '}' && (digits > 0 || comma)) {
+                break;
+            } else {
+                throw Error("invalid repetition");
+            }
+        }
+        i++;
+        if (!comma) hi = lo;
+        else if (digits == 0) hi = -1;
+        else if (hi < lo) throw Error("invalid repetition bounds");
+    }
+
+    /**
+     * @brief 读入一个操作数及其后缀运算符，只消费stop之前的后缀
+     */
+    constexpr Frag operand(std::size_t &i, std::size_t stop) {
+        std::size_t begin = i;
+        int base = positions;
+        Frag f = atom(i);
+        while (i < stop && (re[i] == '*' || re[i] == '{')) {
+            if (re[i] == '*') {
+                i++;
+                f = star(f);
+                continue;
+            }
+            std::size_t end = i;
+            int lo = 0, hi = 0;
+            bounds(i,lo,hi);
+            positions = base; // 丢弃已解析的操作数，按次数重新生成副本
+            f = Frag();
+            for (int k=0; k<lo; k++) f = join(f,copy(begin,end));
+            if (hi < 0) {
+                f = join(f,star(copy(begin,end)));
+            } else {
+                for (int k=lo; k<hi; k++) {
+                    Frag g = copy(begin,end);
+                    g.nullable = true;
+                    f = join(f,g);
+                }
+            }
+        }
+        return f;
+    }
+
+    constexpr Frag copy(std::size_t begin, std::size_t end) { return operand(begin,end); }
+
+    constexpr Frag concat(std::size_t &i) {
+        if (i >= n || re[i] == '+' || re[i] == ')') throw Error("missing operand");
+        Frag f = operand(i,n);
+        while (i < n && re[i] != '+' && re[i] != ')') f = join(f,operand(i,n));
+        return f;
+    }
+
+    constexpr Frag alt(std::size_t &i) {
+        Frag f = concat(i);
+        while (i < n && re[i] == '+') {
+            i++;
+            Frag g = concat(i);
+            f.first |= g.first;
+            f.last |= g.last;
+            f.nullable = f.nullable || g.nullable;
+        }
+        return f;
+    }
+};
+
+} // namespace detail
+
+/**
+ * @brief 在编译期把正则表达式编译为最小DFA
+ * @tparam MaxStates 子集构造过程中的状态数上限
+ * @tparam MaxClasses 字节等价类数上限
+ * @param re 正则表达式字面量
+ */
+template <int MaxStates = 64, int MaxClasses = 32, std::size_t N>
+constexpr Dfa<MaxStates,MaxClasses> compile(const char (&re)[N]) {
+    using namespace detail;
+    Glushkov g(re,N-1);
+    std::size_t i = 0;
+    Frag root = g.alt(i);
+    if (i < g.n) throw Error("unmatched ')'");
+
+    // 字节按接受它的位置集合划分等价类
+    Dfa<MaxStates,MaxClasses> raw;
+    std::uint64_t class_mask[MaxClasses] = {};
+    for (unsigned b=0; b<256; b++) {
+        std::uint64_t m = 0;
+        for (int p=0; p<g.positions; p++) if (g.sym[p].has(b)) m |= 1ull<<p;
+        int c = 0;
+        while (c < raw.classes && class_mask[c] != m) c++;
+        if (c == raw.classes) {
+            if (c == MaxClasses) throw Error("too many byte classes; raise MaxClasses");
+            class_mask[raw.classes++] = m;
+        }
+        raw.cls[b] = (unsigned char)c;
+    }
+
+    // 子集构造，空集即陷阱态
+    std::uint64_t sets[MaxStates] = {};
+    sets[0] = INITIAL;
+    raw.states = 1;
+    for (int s=0; s<raw.states; s++) {
+        std::uint64_t reach = (sets[s]&INITIAL) ? root.first : 0;
+        for (int p=0; p<g.positions; p++) if ((sets[s]>>p)&1) reach |= g.follow[p];
+        raw.accept[s] = (sets[s]&root.last) || ((sets[s]&INITIAL) && root.nullable);
+        for (int c=0; c<raw.classes; c++) {
+            std::uint64_t t = reach&class_mask[c];
+            int q = 0;
+            while (q < raw.states && sets[q] != t) q++;
+            if (q == raw.states) {
+                if (q == MaxStates) throw Error("too many states; raise MaxStates");
+                sets[raw.states++] = t;
+            }
+            raw.next[s][c] = q;
+        }
+    }
+
+    // Moore划分细化：按(所在块, 各后继所在块)重新编号，直到块数不变
+    int block[MaxStates] = {};
+    int blocks = 0;
+    for (int s=0; s<raw.states; s++) {
+        int t = 0;
+        while (t < s && raw.accept[t] != raw.accept[s]) t++;
+        block[s] = t < s ? block[t] : blocks++;
+    }
+    while (true) {
+        int refined[MaxStates] = {};
+        int count = 0;
+        for (int s=0; s<raw.states; s++) {
+            int t = 0;
+            for (; t<s; t++) {
+                if (block[t] != block[s]) continue;
+                int c = 0;
+                while (c < raw.classes && block[raw.next[t][c]] == block[raw.next[s][c]]) c++;
+                if (c == raw.classes) break;
+            }
+            refined[s] = t < s ? refined[t] : count++;
+        }
+        for (int s=0; s<raw.states; s++) block[s] = refined[s];
+        if (count == blocks) break;
+        blocks = count;
+    }
+
+    Dfa<MaxStates,MaxClasses> dfa;
+    dfa.states = blocks;
+    dfa.classes = raw.classes;
+    for (int b=0; b<256; b++) dfa.cls[b] = raw.cls[b];
+    for (int s=0; s<raw.states; s++) {
+        dfa.accept[block[s]] = raw.accept[s];
+        for (int c=0; c<raw.classes; c++) dfa.next[block[s]][c] = block[raw.next[s][c]];
+    }
+    return dfa;
+}
+
+} // namespace static_regex
+
+#endif
@@ -0,0 +1,82 @@
+// 构造器测试：用regex_expr.h组合的表达式与解析等价文本得到的最小DFA和文法应当相同
+#define RG_NO_MAIN
+#if defined(__GNUC__)
+#pragma GCC diagnostic ignored "-Wunused-function"  // run_batch()等只供main()使用
+#pragma GCC diagnostic ignored "-Wparentheses"      // 下面有意不加括号，检查运算符的优先级
+#endif
+#include "../main.cpp"
+
+#include <sstream>
+
+using namespace regex_expr;
+
+template<class...> struct VoidOf { typedef void type; };
+
+/// A >> B是否能组合
+template<class A, class B, class = void> struct CanConcat : false_type {};
+template<class A, class B>
+struct CanConcat<A,B,typename VoidOf<decltype(declval<A>() >> declval<B>())>::type> : true_type {};
+
+// char和字面量串可以作为操作数，'b'+'c'之类的整数不可以
+static_assert(CanConcat<CharExpr,char>::value, "char is a literal");
+static_assert(CanConcat<CharExpr,const char*>::value, "string is a literal");
+static_assert(!CanConcat<CharExpr,int>::value, "int must not become a byte");
+static_assert(!CanConcat<CharExpr,unsigned char>::value, "only char is a byte literal");
+
+static int failures = 0;
+
+/**
+ * @brief 执行完整流程，返回标准输出上的结果
+ */
+template<class F>
+static string capture(F run) {
+    ostringstream out;
+    streambuf* old = cout.rdbuf(out.rdbuf());
+    run();
+    cout.rdbuf(old);
+    return out.str();
+}
+
+/**
+ * @brief 表达式e与文本text在各种选项下的结果应当相同
+ */
+template<class E>
+static void same(const char* name, const Expr<E> &e, const string &text) {
+    Options opts[4];
+    opts[1].flat = true;
+    opts[2].intern = opts[2].simplify = opts[2].factor = true;
+    opts[3].construction = Options::DERIVATIVE;
+    for (const Options &opt: opts) {
+        Workspace ws;
+        string a = capture([&] { run_pipeline(e,opt,ws); });
+        string b = capture([&] { run_pipeline(RegexInput::from_memory(text.data(),text.size()),opt,ws); });
+        if (a != b) {
+            cout << "FAIL " << name << ": expression differs from " << text << "\n";
+            failures++;
+            return;
+        }
+    }
+}
+
+int main() {
+    // C++的优先级与正则语法一致：>>高于&高于|
+    same("precedence", lit('0') | lit('1') >> '2', "0+12");
+    same("concat-union", lit('0') >> '1' | lit('2') >> '3', "01+23");
+    same("and-union", lit('a') | lit('b') & 'b', "a+b&b");
+    same("and-concat", star(range('a','b')) & lit('a') >> star('b'), "[ab]*&ab*");
+    same("left-assoc", lit('a') | 'b' | "cd", "(a+b)+cd");
+    // *与~只作用于紧随其后的操作数
+    same("star", *(lit('0') | '1') >> '1' >> repeat(alt('0','1'),3,3), "(0+1)*1(0+1){3}");
+    same("complement", ~lit('a') >> 'b', "(~a)b");
+    same("complement-group", ~(lit('a') >> 'b'), "~ab");
+    // 重复、字符类与码点类
+    same("repeat", range('a','c') >> repeat('x',2,UNBOUNDED), "[a-c]x{2,}");
+    same("repeat-nested", repeat(repeat(lit('0'),2,2),3,3), "(0{2}){3}");
+    same("code-range", code_range(0x3b1,0x3c9) >> '1', "[\\u{3b1}-\\u{3c9}]1");
+    // 运行时列表
+    same("alt-of", alt_of(vector<string>{"if","else","while"}) >> star('0'), "(if+else+while)0*");
+    same("seq-of", seq_of(vector<char>{'0','1','0'}) | '1', "010+1");
+
+    if (failures == 0) cout << "all expression tests passed\n";
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,134 @@
+// 解析基准：比较节点池与逐节点new/delete两种语法树分配方式的解析吞吐量和峰值内存
+// 用法：pool_bench pool|new [字节数 [次数]]
+//   输入为'(0+1)*01*(1+0)0'首尾相接到指定字节数(默认1000000)，重复解析指定次数(默认20)。
+//   峰值内存取自getrusage()，是整个进程的值，因此两种方式需分别运行。
+#define RG_NO_MAIN
+#if defined(__GNUC__)
+#pragma GCC diagnostic ignored "-Wunused-function"  // run_batch()等只供main()使用
+#endif
+#include "../main.cpp"
+
+#include <chrono>
+#include <sys/resource.h>
+
+/**
+ * @brief 逐个用new创建节点的Builder，作为节点池的对照
+ *
+ * 与未引入节点池时的解析器一样，每个节点和每段text各自申请内存；
+ * destroy()用显式栈逐个释放，使两种方式都计入释放语法树的开销。
+ */
+struct HeapBuilder {
+    typedef RegexNode* Node; ///< 节点句柄类型
+
+    size_t count = 0; ///< 已创建的节点数
+
+    static Node none() { return nullptr; }
+
+    Node make(RegexNode::Type t, char c=0, Node l=nullptr, Node r=nullptr) {
+        count++;
+        return new RegexNode(t,c,l,r);
+    }
+
+    Node make_string(const char* s, int n) {
+        if (n == 1) return make(RegexNode::CHAR,s[0]);
+        return make_payload(RegexNode::STRING,s,n);
+    }
+
+    Node make_class(const ByteSet &set) {
+        if (set.count() == 1) {
+            for (int b=0; b<256; b++) {
+                if (set.has((unsigned char)b)) return make(RegexNode::CHAR,(char)b);
+            }
+        }
+        return make_payload(RegexNode::CLASS,set.data(),32);
+    }
+
+    Node make_uclass(const vector<CodeRange> &ranges) {
+        string t = encode_code_ranges(ranges);
+        return make_payload(RegexNode::UCLASS,t.data(),(int)t.size());
+    }
+
+    Node make_repeat(Node child, int lo, int hi) {
+        string t = RegexNode::encode_bounds(lo,hi);
+        return make_payload(RegexNode::REPEAT,t.data(),(int)t.size(),child);
+    }
+
+    void reserve(size_t) {}
+
+    /**
+     * @brief 释放以root为根的整棵语法树
+     */
+    void destroy(Node root) {
+        vector<Node> stack;
+        if (root) stack.push_back(root);
+        while (!stack.empty()) {
+            Node node = stack.back();
+            stack.pop_back();
+            if (node->left) stack.push_back(node->left);
+            if (node->right) stack.push_back(node->right);
+            delete[] node->text;
+            delete node;
+        }
+        count = 0;
+    }
+
+private:
+    Node make_payload(RegexNode::Type t, const char* s, int n, Node l=nullptr) {
+        Node node = make(t,0,l,nullptr);
+        char* text = new char[n];
+        memcpy(text,s,n);
+        node->text = text;
+        node->len = n;
+        return node;
+    }
+};
+
+/**
+ * @brief 解析reps次，输出节点数、每次耗时、吞吐量和峰值内存
+ */
+template<class Builder, class Release>
+static void bench(const char* name, const string &re, int reps, Builder &builder, Release release) {
+    BasicRegexParser<Builder> parser(builder);
+    size_t nodes = 0;
+    auto start = chrono::steady_clock::now();
+    for (int r=0; r<reps; r++) {
+        typename Builder::Node root = parser.parse(re.data(),re.size());
+        nodes = release(root);
+    }
+    double ms = chrono::duration<double,milli>(chrono::steady_clock::now()-start).count();
+    struct rusage ru;
+    getrusage(RUSAGE_SELF,&ru);
+    printf("%s: %zu bytes, %zu nodes, %.3f ms/parse, %.1f MB/s, maxrss %ld MB\n",
+           name,re.size(),nodes,ms/reps,re.size()*reps/ms/1000,ru.ru_maxrss/1024);
+}
+
+int main(int argc, char** argv) {
+    string mode = argc > 1 ? argv[1] : "";
+    size_t bytes = argc > 2 ? strtoul(argv[2],nullptr,10) : 1000000;
+    int reps = argc > 3 ? atoi(argv[3]) : 20;
+    if ((mode != "pool" && mode != "new") || bytes == 0 || reps <= 0) {
+        fprintf(stderr,"usage: pool_bench pool|new [bytes [reps]]\n");
+        return 2;
+    }
+    const string unit = "(0+1)*01*(1+0)0";
+    string re;
+    while (re.size()+unit.size() <= max(bytes,unit.size())) re += unit;
+
+    if (mode == "pool") {
+        RegexNodePool pool;
+        // 与run_pipeline()一样，下一次解析前reset()，复用已申请的块
+        bench("pool",re,reps,pool,[&](RegexNode*) {
+            size_t n = pool.size();
+            pool.reset();
+            return n;
+        });
+    } else {
+        HeapBuilder heap;
+        bench("new",re,reps,heap,[&](RegexNode* root) {
+            size_t n = heap.count;
+            heap.destroy(root);
+            return n;
+        });
+    }
+    return 0;
+}
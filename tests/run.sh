@@ -0,0 +1,212 @@
+#!/bin/sh
+# 回归测试：每组的两个正则表达式应当得到相同的输出
+# 用法：tests/run.sh RG可执行文件
+RG=${1:?usage: run.sh path/to/RG}
+fail=0
+
+# same 选项 表达式1 表达式2
+same() {
+    a=$(printf '%s\n' "$2" | "$RG" $1)
+    status=$?
+    if [ $status -ne 0 ]; then
+        echo "FAIL ($1): exit status $status on $(printf '%.40s' "$2")..."
+        fail=1
+        return
+    fi
+    b=$(printf '%s\n' "$3" | "$RG" $1)
+    if [ "$a" != "$b" ]; then
+        echo "FAIL ($1): $(printf '%.40s' "$2") differs from $(printf '%.40s' "$3")"
+        fail=1
+    fi
+}
+
+# agree 选项 表达式：与默认的Thompson构造得到相同的输出
+agree() {
+    a=$(printf '%s\n' "$2" | "$RG")
+    b=$(printf '%s\n' "$2" | "$RG" $1)
+    status=$?
+    if [ $status -ne 0 ]; then
+        echo "FAIL ($1): exit status $status on $(printf '%.40s' "$2")..."
+        fail=1
+    elif [ "$a" != "$b" ]; then
+        echo "FAIL ($1): $(printf '%.40s' "$2") differs from the default construction"
+        fail=1
+    fi
+}
+
+# stage 选项 表达式 模式：--stats的输出中有与模式匹配的一行
+stage() {
+    if ! printf '%s\n' "$2" | "$RG" --stats $1 2>&1 >/dev/null | grep -q "$3"; then
+        echo "FAIL ($1): no '$3' in --stats on $(printf '%.40s' "$2")"
+        fail=1
+    fi
+}
+
+# each_input 命令 参数...：对下列每个表达式执行"命令 参数... 表达式"
+# 其中有交、补、重复次数、码点类以及可删去的死状态
+each_input() {
+    while IFS= read -r re; do
+        "$@" "$re"
+    done <<'EOF'
+(0+1)*1(0+1){2,3}
+((0*1*)*(1*0)*)*
+[a-c]{2,3}x*+(ab){0,}c
+(0{2}){3}+1{0,2}0
+\u{3b1}{1,2}(0+\u{4e2d})*
+[\u{3b1}-\u{3c9}\u{1f600}]+x
+~(0*1)&(01)*
+~((0+1)*00(0+1)*)
+[a-c]{2,3}x*&~(ax*)
+(0&1)1*0+1
+~\u{3b1}&(\u{3b1}+0){1,2}
+EOF
+}
+
+# 深层嵌套：解析、构造与求导都不随嵌套深度递归
+deep=$(awk 'BEGIN { n = 200000; for (i=0; i<n; i++) printf "("; printf "0"; for (i=0; i<n; i++) printf "){0,1}" }')
+for c in glushkov compact derivative antimirov; do
+    same "--construction=$c" "$deep" "0{0,1}"
+done
+
+# 长的公共后缀：合并相同状态与求模拟关系都不逐层重复整轮计算
+suffix=$(awk 'BEGIN { n = 2000; printf "1"; for (i=0; i<n; i++) printf "0"; printf "+"; for (i=0; i<=n; i++) printf "0" }')
+for o in --construction=compact --construction=follow --reduce=bisimulation --reduce=simulation; do
+    same "$o" "$suffix" "(1+0)0{2000}"
+done
+
+# 字符类之外的\u{...}是一个运算单元，其后的'*'与重复次数作用于整个字符
+open=$(awk 'BEGIN { for (i=0; i<65530; i++) printf "(" }')
+close=$(awk 'BEGIN { for (i=0; i<65530; i++) printf ")" }')
+for o in "" --flat; do
+    same "$o" '\u{3b1}*' '(\u{3b1})*'
+    same "$o" '\u{3b1}{2}' '\u{3b1}\u{3b1}'
+    same "$o" 'a\u{4e2d}{1,3}b' 'a(\u{4e2d}){1,3}b'
+    same "$o" '0\u{1f600}*1' '0(\u{1f600})*1'
+    # 字面量跨越输入的64KiB分块边界
+    same "$o" "${open}0000000000\\u{3b1}*1$close" "${open}0000000000(\\u{3b1})*1$close"
+done
+
+# 位置自动机与follow自动机：不含交与补时直接构造，否则改用Thompson构造
+for c in glushkov follow; do
+    each_input agree "--construction=$c"
+done
+stage --construction=glushkov '(0+1)*1(0+1){2,3}' '^glushkov: '
+stage --construction=follow '[a-c]{2,3}x*' '^follow: '
+stage --construction=glushkov '~(0*1)&(01)*' 'unsupported operator, using thompson'
+
+# Brzozowski导数直接得到DFA，交与补也不改用Thompson构造
+each_input agree --construction=derivative
+stage --construction=derivative '~(0*1)&(01)*' '^derivative: '
+stage --construction=derivative '\u{3b1}{1,2}(0+\u{4e2d})*' '^derivative: '
+
+# Antimirov偏导数：不含交与补时直接得到无ε转移的NFA
+each_input agree --construction=antimirov
+stage --construction=antimirov '\u{3b1}{1,2}(0+\u{4e2d})*' '^antimirov: '
+stage --construction=antimirov '[a-c]{2,3}x*&~(ax*)' 'unsupported operator, using thompson'
+
+# 冻结为按符号分块的CSR形式：没有关闭冻结的选项，导数构造不经过NFA，
+# 因此用它对照按符号取出转移的结果；输入含多个字节类与码点类
+for re in '[a-z0-9]*q[\u{3b1}-\u{3c9}]{1,2}' '(a+b+c+d+e+f+g+h)*h{2}' '~([a-h]*h)&[a-h]{0,4}'; do
+    for o in "" --flat --construction=glushkov; do
+        a=$(printf '%s\n' "$re" | "$RG" $o)
+        b=$(printf '%s\n' "$re" | "$RG" --construction=derivative)
+        if [ "$a" != "$b" ]; then
+            echo "FAIL ($o): $re differs from the derivative construction"
+            fail=1
+        fi
+    done
+    stage "" "$re" '^freeze: [0-9]* bytes'
+done
+
+# 按遍历顺序重新编号NFA状态不改变结果，也不增减状态
+for o in bfs dfs; do
+    each_input agree "--renumber=$o"
+    each_input agree "--renumber=$o --construction=glushkov"
+    stage "--renumber=$o" '(0+1)*' "^renumber ($o): 8 states"
+done
+
+# 按互模拟合并状态、按模拟关系删减子集都不改变结果
+for o in bisimulation simulation; do
+    each_input agree "--reduce=$o"
+    each_input agree "--reduce=$o --construction=antimirov"
+done
+stage --reduce=bisimulation '0(0+1)+1(0+1)' '^bisimulation: 16 -> 5 states'
+stage --reduce=simulation '0(0+1)+1(0+1)' '^simulation: 2 of 5 states dominated'
+
+# 删去死状态：空的交运算及其后的部分不留在NFA中，结果与不写这些部分相同
+for o in "" --construction=compact --renumber=dfs --reduce=simulation; do
+    same "$o" '(0&1)1*0+1' '1'
+    same "$o" '(00&0)*1' '1'
+done
+stage "" '(0&1)1*0+1' '^trim: 13 -> 3 states, dropped 10'
+stage "" '0&1' '^trim: 3 -> 1 states, dropped 2'
+
+# ε环：嵌套的星号在ε图中形成强连通分量，分量内的状态有相同的ε闭包
+for o in "" --renumber=bfs --reduce=bisimulation; do
+    same "$o" '((0*1*)*(1*0)*)*' '(0+1)*'
+    same "$o" '((0*)*)*1' '0*1'
+    same "$o" '((0*)*&(0*0*)*)1' '0*1'
+done
+stage "" '((0*1*)*(1*0)*)*' '12 closure components'
+
+# 嵌套的重复次数相乘，展开超过上限时报错退出，而不是耗尽内存
+for o in "" --construction=glushkov --construction=compact --flat; do
+    for re in '0{100000}{100000}' '(0{100}1){100000}' '((0{100}){100}){1000}'; do
+        err=$(printf '%s\n' "$re" | "$RG" $o 2>&1 >/dev/null)
+        if [ $? -ne 1 ] || [ "${err#error: repetition expands}" = "$err" ]; then
+            echo "FAIL ($o): $re not rejected: $err"
+            fail=1
+        fi
+    done
+done
+same "" '(0{2}){3}{4}' '0{24}'
+
+# --file的字面量串直接引用映射的文件，结果与从标准输入读入时相同
+file=$(mktemp)
+printf '%s\n' 'abcdefgh(ijk+abcdefgh)*ijk+abc\x64efgh{2}ijk+abcdefghijk' >"$file"
+for o in "" --intern "--simplify --factor" "--intern --simplify --factor"; do
+    a=$("$RG" $o <"$file")
+    b=$("$RG" $o --file "$file")
+    if [ "$a" != "$b" ]; then
+        echo "FAIL ($o --file): differs from standard input"
+        fail=1
+    fi
+done
+rm -f "$file"
+
+# 拼错的选项不会被忽略
+for o in --bacth --stat --construction=thomson --file; do
+    if printf '0\n' | "$RG" $o >/dev/null 2>&1; then
+        echo "FAIL: option $o accepted"
+        fail=1
+    fi
+done
+
+# --batch与--file合用时读--file给出的文件；两处都给出文件时报错
+file=$(mktemp)
+printf '01\n(0+1)*1\n' >"$file"
+a=$("$RG" --batch "$file" | grep -v '^# time')
+b=$("$RG" --batch --file "$file" </dev/null | grep -v '^# time')
+c=$("$RG" --file "$file" --batch </dev/null | grep -v '^# time')
+if [ -z "$a" ] || [ "$a" != "$b" ] || [ "$a" != "$c" ]; then
+    echo "FAIL: --batch --file does not read the file"
+    fail=1
+fi
+if "$RG" --batch "$file" --file "$file" </dev/null >/dev/null 2>&1; then
+    echo "FAIL: --batch FILE --file FILE accepted"
+    fail=1
+fi
+rm -f "$file"
+
+# 交互输入：回车后即输出结果，不等待输入结束
+out=$(mktemp)
+{ printf '01\n'; sleep 2; } | "$RG" >"$out" 2>/dev/null &
+sleep 1
+if [ ! -s "$out" ]; then
+    echo "FAIL: no output before end of input"
+    fail=1
+fi
+wait
+rm -f "$out"
+
+exit $fail
@@ -0,0 +1,97 @@
+// 编译期正则表达式测试：static_assert检查static_regex::compile()的结果，
+// 再在运行期与主程序的流水线(Thompson构造、子集构造、最小化)逐串对照
+#define RG_NO_MAIN
+#if defined(__GNUC__)
+#pragma GCC diagnostic ignored "-Wunused-function"  // run_batch()等只供main()使用
+#endif
+#include "../main.cpp"
+#include "../static_regex.h"
+
+constexpr auto ends_with_1x = static_regex::compile("(0+1)*1(0+1)");
+static_assert(ends_with_1x.states == 5, "four states plus the trap");
+static_assert(ends_with_1x.match("10") && ends_with_1x.match("0011"), "second to last is 1");
+static_assert(!ends_with_1x.match("01") && !ends_with_1x.match("1") && !ends_with_1x.match(""), "");
+static_assert(!ends_with_1x.match("12"), "bytes outside the alphabet are rejected");
+
+constexpr auto bounded = static_regex::compile("[a-c]{2,3}x*");
+static_assert(bounded.match("ab") && bounded.match("cba") && bounded.match("aaxxx"), "");
+static_assert(!bounded.match("a") && !bounded.match("abcd") && !bounded.match("xab"), "");
+
+constexpr auto nested = static_regex::compile("(0{2}){3}");
+static_assert(nested.states == 8, "seven counting states plus the trap");
+static_assert(nested.match("000000"), "");
+static_assert(!nested.match("00000") && !nested.match("0000000"), "");
+
+constexpr auto escaped = static_regex::compile("[^0-9]\\x2b\\u{41}+\\*");
+static_assert(escaped.match("a+A") && escaped.match("*") && !escaped.match("0+A"), "");
+
+static int failures = 0;
+
+/**
+ * @brief 运行期流水线得到的最小DFA
+ */
+struct RuntimeDfa {
+    ByteClasses alphabet;
+    DFA dfa;
+
+    explicit RuntimeDfa(const char* re) {
+        RegexNodePool pool;
+        BasicRegexParser<RegexNodePool> parser(pool);
+        RegexNode* root = parser.parse(re,strlen(re));
+        alphabet.collect(root);
+        FrozenNFA frozen(Thompson(root,alphabet).build());
+        if (frozen.has_epsilon()) frozen = EpsilonRemover(frozen).remove();
+        frozen = NFATrimmer::trim(frozen);
+        DFA d = SubsetConstruction(frozen).convert();
+        dfa = DFAMinimizer(d).minimize();
+    }
+
+    bool match(const string &s) const {
+        int q = dfa.start;
+        for (unsigned char b: s) {
+            int c = alphabet.of(b);
+            if (q < 0 || c < 0) return false;
+            q = dfa.states[q].next[c];
+        }
+        return q >= 0 && dfa.states[q].accept;
+    }
+};
+
+/**
+ * @brief 对字母表sigma上长度不超过max_len的每个串，比较编译期DFA与运行期流水线的判定
+ */
+template<class D>
+static void same(const char* re, const D &compiled, const string &sigma, int max_len) {
+    RuntimeDfa runtime(re);
+    // 编译期的表中总有陷阱态，运行期的最小DFA只在需要时才有
+    int states = (int)runtime.dfa.states.size() + (runtime.dfa.trap < 0);
+    if (compiled.states != states) {
+        cout << "FAIL " << re << ": " << compiled.states << " states, runtime " << states << "\n";
+        failures++;
+    }
+    vector<string> level(1,string());
+    for (int len=0; len<=max_len; len++) {
+        vector<string> next;
+        for (const string &s: level) {
+            if (compiled.match(s) != runtime.match(s)) {
+                cout << "FAIL " << re << ": \"" << s << "\" compiled " << compiled.match(s)
+                     << ", runtime " << runtime.match(s) << "\n";
+                failures++;
+                return;
+            }
+            for (char c: sigma) next.push_back(s+c);
+        }
+        level.swap(next);
+    }
+}
+
+int main() {
+    // 字母表中多放一个表达式里没有的字节，检查两边都拒绝
+    same("(0+1)*1(0+1)",ends_with_1x,"01z",10);
+    same("[a-c]{2,3}x*",bounded,"abcxd",7);
+    same("(0{2}){3}",nested,"01",9);
+    same("[^0-9]\\x2b\\u{41}+\\*",escaped,"0a+A*",5);
+
+    if (failures == 0) cout << "all static_regex tests passed\n";
+    return failures == 0 ? 0 : 1;
+}
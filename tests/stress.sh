@@ -0,0 +1,37 @@
+#!/bin/sh
+# 压力测试：生成指定大小的正则表达式，报告解析与Thompson构造的规模和耗时
+# 用法：tests/stress.sh RG可执行文件 [deep|flat] [兆字节数...]
+#   deep  '('重复k次、'0'、'){0,1}'重复k次，嵌套深度随输入线性增长(默认)
+#   flat  '(01+10)*0'首尾相接，每字节约1.3个Thompson状态，内存需求约为deep的五倍
+# 默认大小为1 10 50。只运行到Thompson构造：读到thompson一行后关闭管道，
+# 程序在写出下一行统计时结束，不进入ε消除与子集构造。
+RG=${1:?usage: stress.sh path/to/RG [deep|flat] [MB...]}
+shift
+shape=deep
+case $1 in
+    deep|flat) shape=$1; shift ;;
+esac
+[ $# -gt 0 ] || set -- 1 10 50
+
+input=$(mktemp)
+trap 'rm -f "$input"' EXIT
+
+for mb in "$@"; do
+    if [ "$shape" = deep ]; then
+        awk -v n=$((mb*1000000)) 'BEGIN {
+            k = int((n-1)/7)
+            for (i=0; i<k; i++) printf "("
+            printf "0"
+            for (i=0; i<k; i++) printf "){0,1}"
+            printf "\n"
+        }' >"$input"
+    else
+        awk -v n=$((mb*1000000)) 'BEGIN {
+            u = "(01+10)*0"
+            for (w=0; w+length(u)<=n; w+=length(u)) printf "%s", u
+            printf "\n"
+        }' >"$input"
+    fi
+    printf '%s %s MB\n' "$shape" "$mb"
+    "$RG" --stats --file "$input" 2>&1 >/dev/null | sed -n -e '/^parse:/p' -e '/^thompson:/{p;q}'
+done